@@ -51,7 +51,6 @@ public:
         }
     }
 
-    // @ not tested
     T& insert(int i, const T& val)
     {
         ++size_;
@@ -60,7 +59,7 @@ public:
             capacity_ = size_ * 2;
             grow();
         }
-        memmove(data_ + i + 1, data_ + i, size_ - i - 1);
+        memmove(data_ + i + 1, data_ + i, (size_ - i - 1) * sizeof(T));
         data_[i] = val;
         return data_[i];
     }
@@ -73,7 +72,7 @@ public:
 
     T& erase(int i, int count)
     {
-        memmove(data_ + i, data_ + i + count, size_ - i - count);
+        memmove(data_ + i, data_ + i + count, (size_ - i - count) * sizeof(T));
         size_ -= count;
         return data_[i];
     }
@@ -152,3 +151,168 @@ private:
     int size_ = 0;
     T data_[N];
 };
+
+// byte FIFO (send buffers); the capacity is a power of two and the data wraps around the end
+// of the buffer, so consume() does not move the rest of the data; the readable data and the free
+// space are accessed as (at most) two contiguous spans, for writev() and the copies from the
+// worker queues; the receive buffers stay linear Arrays, the messages are parsed in place
+class RingBuffer
+{
+public:
+    struct Span
+    {
+        char* data;
+        int size;
+    };
+
+    RingBuffer() = default;
+    ~RingBuffer() {free(data_);}
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // the contents are preserved
+    void reserve(int size)
+    {
+        if(size <= capacity_)
+            return;
+
+        int capacity = capacity_ ? capacity_ : 64;
+
+        while(capacity < size)
+            capacity *= 2;
+
+        char* const data = (char*)malloc(capacity);
+        assert(data);
+        Span spans[2];
+        const int numSpans = getReadSpans(spans);
+        int offset = 0;
+
+        for(int i = 0; i < numSpans; ++i)
+        {
+            memcpy(data + offset, spans[i].data, spans[i].size);
+            offset += spans[i].size;
+        }
+
+        free(data_);
+        data_ = data;
+        capacity_ = capacity;
+        head_ = 0;
+    }
+
+    // grows if needed
+    void write(const void* data, int size)
+    {
+        reserve(size_ + size);
+        Span spans[2];
+        const int numSpans = getWriteSpans(spans);
+        int offset = 0;
+
+        for(int i = 0; i < numSpans && offset < size; ++i)
+        {
+            const int n = spans[i].size < size - offset ? spans[i].size : size - offset;
+            memcpy(spans[i].data, (const char*)data + offset, n);
+            offset += n;
+        }
+
+        size_ += size;
+    }
+
+    // returns the number of spans (0 - 2), the first one starts at the oldest byte
+    int getReadSpans(Span* spans) const
+    {
+        const int first = size_ < capacity_ - head_ ? size_ : capacity_ - head_;
+        return getSpans(spans, head_, first, size_ - first);
+    }
+
+    // the free space, use reserve() first; the bytes written are added with commitWrite()
+    int getWriteSpans(Span* spans)
+    {
+        const int tail = (head_ + size_) & (capacity_ - 1);
+        const int numFree = capacity_ - size_;
+        const int first = numFree < capacity_ - tail ? numFree : capacity_ - tail;
+        return getSpans(spans, tail, first, numFree - first);
+    }
+
+    void commitWrite(int size)
+    {
+        assert(size >= 0 && size_ + size <= capacity_);
+        size_ += size;
+    }
+
+    // removes the oldest bytes
+    void consume(int size)
+    {
+        assert(size >= 0 && size <= size_);
+        size_ -= size;
+        head_ = size_ ? (head_ + size) & (capacity_ - 1) : 0;
+    }
+
+    void clear()          {head_ = 0; size_ = 0;}
+    int  size()     const {return size_;}
+    int  capacity() const {return capacity_;}
+    bool empty()    const {return size_ == 0;}
+
+private:
+    char* data_ = nullptr;
+    int capacity_ = 0;
+    int head_ = 0;
+    int size_ = 0;
+
+    int getSpans(Span* spans, int begin, int first, int second) const
+    {
+        int numSpans = 0;
+
+        if(first)
+            spans[numSpans++] = {data_ + begin, first};
+
+        if(second)
+            spans[numSpans++] = {data_, second};
+
+        return numSpans;
+    }
+};
+
+// 2D array with the dimensions set at runtime, the rows are stored one after another in one
+// buffer; grid[y][x]
+// does not respect constructors & destructors
+template<typename T>
+class Grid
+{
+public:
+    // the contents are not preserved; no allocation if the size does not grow
+    void resize(int width, int height)
+    {
+        assert(width >= 0 && height >= 0);
+        width_ = width;
+        height_ = height;
+        data_.resize(width * height);
+    }
+
+    // resizes if needed
+    void assign(const Grid<T>& other)
+    {
+        if(width_ != other.width_ || height_ != other.height_)
+            resize(other.width_, other.height_);
+
+        memcpy(data_.data(), other.data_.data(), other.size() * sizeof(T));
+    }
+
+    void fill(const T& t)
+    {
+        for(T& v: data_)
+            v = t;
+    }
+
+    T*       operator[](int y)       {return data_.data() + y * width_;}
+    const T* operator[](int y) const {return data_.data() + y * width_;}
+    T*       data()                  {return data_.data();}
+    const T* data()            const {return data_.data();}
+    int      width()           const {return width_;}
+    int      height()          const {return height_;}
+    int      size()            const {return data_.size();}
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    Array<T> data_;
+};
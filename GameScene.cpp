@@ -2,463 +2,8 @@
 #include "imgui/imgui.h"
 #include "GLFW/glfw3.h"
 #include <stdio.h>
-#include <stdarg.h>
-
-// includes for the netcode
-#include <sys/types.h>
-#include <netdb.h>
-#include <unistd.h>
-#include <arpa/inet.h>
-#include <errno.h>
 #include <string.h>
-#include <fcntl.h>
-#include <netinet/tcp.h>
-
-namespace netcode
-{
-
-void log(Array<char>& buf, const char* fmt, ...)
-{
-    static char bigbuf[1024];
-
-    va_list args;
-    va_start(args, fmt);
-    vsnprintf(bigbuf, (sizeof bigbuf) - 1, fmt, args);
-    va_end(args);
-
-    int len = strlen(bigbuf);
-    bigbuf[len++] = '\n';
-
-    const int prevSize = buf.size();
-    buf.resize(len + prevSize);
-    memmove(buf.begin() + len, buf.begin(), prevSize);
-    memcpy(buf.begin(), bigbuf, len);
-
-    if(buf.size() > 9000)
-    {
-        buf.resize(9000);
-        buf.back() = '\0';
-    }
-}
-
-// returns socket descriptior, -1 if failed
-// if succeeded you have to free the socket yourself
-// @TODO: this must be non-blocking connect
-int connect(Array<char>& logBuf, const char* host)
-{
-    addrinfo hints = {};
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-
-    addrinfo* list;
-    {
-        // this block (domain name resolution)
-        const int ec = getaddrinfo(host, "3000", &hints, &list);
-        if(ec != 0)
-        {
-            log(logBuf, "getaddrinfo() failed: %s", gai_strerror(ec));
-            return -1;
-        }
-    }
-
-    int sockfd;
-
-    const addrinfo* it;
-    for(it = list; it != nullptr; it = it->ai_next)
-    {
-        sockfd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
-        if(sockfd == -1)
-        {
-            log(logBuf, "socket() failed: %s", strerror(errno));
-            continue;
-        }
-
-        if(connect(sockfd, it->ai_addr, it->ai_addrlen) == -1)
-        {
-            close(sockfd);
-            log(logBuf, "connect() failed: %s", strerror(errno));
-            continue;
-        }
-
-        char name[INET6_ADDRSTRLEN];
-        inet_ntop(it->ai_family, get_in_addr(it->ai_addr), name, sizeof(name));
-
-        log(logBuf, "connected to %s", name);
-        break;
-    }
-    freeaddrinfo(list);
-
-    if(it == nullptr)
-    {
-        log(logBuf, "connection procedure failed");
-        return -1;
-    }
-
-    if(fcntl(sockfd, F_SETFL, O_NONBLOCK) == -1)
-    {
-        close(sockfd);
-        log(logBuf, "fcntl() failed: %s", strerror(errno));
-        return -1;
-    }
-
-    {
-        const int option = 1;
-        if(setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &option, sizeof(option)) == -1)
-        {
-            close(sockfd);
-            log(logBuf, "setsockopt() (TCP_NODELAY) failed: %s", strerror(errno));
-            return -1;
-        }
-    }
-
-    return sockfd;
-}
-
-NetClient::NetClient()
-{
-    sendBuf.reserve(500);
-    recvBuf.resize(500);
-    logBuf.reserve(10000);
-    logBuf.pushBack('\0'); // terminate with null
-
-    // so we have valid data to display during the time when inGame is set to
-    // true but no Simulation data arrived from the server yet
-    sim.setNewGame(); 
-}
-
-NetClient::~NetClient()
-{
-    if(sockfd != -1)
-        close(sockfd);
-}
-
-// count - move by this many words
-void gotoNextWord(const char** buf, int count)
-{
-    for(int i = 0; i < count; ++i)
-    {
-        while(**buf != ' ')
-            ++(*buf);
-
-        ++(*buf);
-    }
-}
-
-void NetClient::update(const float dt, const char* name, FixedArray<ExploEvent, 50>& exploEvents,
-                    Action& playerAction)
-{
-    if(inGame)
-    {
-        char buf[10] = {};
-
-        sprintf(buf, "%d %d %d %d %d", playerAction.up, playerAction.down, playerAction.left,
-                playerAction.right, playerAction.drop);
-
-        addMsg(sendBuf, Cmd::PlayerInput, buf);
-    }
-
-    // time managment
-    timerAlive += dt;
-    timerReconnect += dt;
-    timerSendSetNameMsg += dt;
-
-    if(hasToReconnect)
-    {
-        inGame = false;
-
-        if(timerReconnect >= timerReconnectMax)
-        {
-            timerReconnect = 0.f;
-
-            if(sockfd != -1)
-                close(sockfd);
-
-            assert(strlen(host));
-            sockfd = connect(logBuf, host);
-
-            if(sockfd != -1)
-            {
-                serverAlive = true;
-                timerAlive = timerAliveMax;
-                hasToReconnect = false;
-                sendBuf.clear();
-                sendSetNameMsg = true;
-            }
-        }
-    }
-
-    if(sendSetNameMsg && (timerSendSetNameMsg >= timerReconnectMax))
-    {
-        sendSetNameMsg = false;
-        timerSendSetNameMsg = 0.f;
-
-        int len = strlen(name);
-        assert(len < Player::NameBufSize);
-        assert(len);
-        addMsg(sendBuf, Cmd::SetName, name);
-    }
-
-    // update
-    if(!hasToReconnect)
-    {
-        if(timerAlive > timerAliveMax)
-        {
-            timerAlive = 0.f;
-
-            if(serverAlive)
-            {
-                serverAlive = false;
-                addMsg(sendBuf, Cmd::Ping);
-            }
-            else
-            {
-                hasToReconnect = true;
-                log(logBuf, "no PONG response from server, will try to reconnect\n");
-            }
-        }
-    }
-
-    // receive
-    if(!hasToReconnect)
-    {
-        while(true)
-        {
-            const int numFree = recvBuf.size() - recvBufNumUsed;
-            const int rc = recv(sockfd, recvBuf.data() + recvBufNumUsed, numFree, 0);
-
-            if(rc == -1)
-            {
-                if(errno != EAGAIN || errno != EWOULDBLOCK)
-                {
-                    log(logBuf, "recv() failed: %s", strerror(errno));
-                    hasToReconnect = true;
-                }
-
-                break;
-            }
-            else if(rc == 0)
-            {
-                log(logBuf, "server has closed the connection\n");
-                hasToReconnect = true;
-                break;
-            }
-            else
-            {
-                recvBufNumUsed += rc;
-
-                if(recvBufNumUsed < recvBuf.size())
-                    break;
-
-                recvBuf.resize(recvBuf.size() * 2);
-
-                if(recvBuf.size() > 10000)
-                {
-                    log(logBuf, "recvBuf BIG SIZE ISSUE, clearing the buffer\n");
-                    recvBufNumUsed = 0;
-                }
-            }
-        }
-    }
-
-    bool newGame = false;
-
-    // process received data
-    {
-        const char* end = recvBuf.data();
-        const char* begin;
-
-        while(true)
-        {
-            begin = end;
-            {
-                const char* tmp = (const char*)memchr((const void*)end, '\0',
-                                   recvBuf.data() + recvBufNumUsed - end);
-
-                if(tmp == nullptr) break;
-                end = tmp;
-            }
-
-            ++end;
-
-            //printf("received msg: '%s'\n", begin);
-
-            int cmd = 0;
-            for(int i = 1; i < Cmd::_count; ++i)
-            {
-                const char* const cmdStr = getCmdStr(i);
-                const int cmdLen = strlen(cmdStr);
-
-                if(cmdLen > int(strlen(begin)))
-                    continue;
-
-                if(strncmp(begin, cmdStr, cmdLen) == 0)
-                {
-                    cmd = i;
-                    begin += cmdLen + 1; // ' '
-                    break;
-                }
-            }
-
-            switch(cmd)
-            {
-                case 0:
-                    log(logBuf, "WARNING unknown command received: %s", begin);
-                    break;
-
-                case Cmd::Ping:
-                    addMsg(sendBuf, Cmd::Pong);
-                    break;
-
-                case Cmd::Pong:
-                    serverAlive = true;
-                    break;
-
-                case Cmd::Chat:
-                    log(logBuf, begin);
-                    break;
-
-                case Cmd::GameFull:
-                {
-                    log(logBuf, "%s", getCmdStr(cmd));
-                    sendSetNameMsg = true;
-                    break;
-                }
-
-                case Cmd::NameOk:
-                {
-                    log(logBuf, "%s %s", getCmdStr(cmd), begin);
-                    inGame = true;
-                    int len = strlen(begin);
-                    assert(len < Player::NameBufSize);
-                    memcpy(inGameName, begin, len);
-                    inGameName[len] = '\0';
-                    break;
-                }
-
-                case Cmd::MustRename:
-                {
-                    if(inGame)
-                        log(logBuf, "%s, could not rename to %s", getCmdStr(cmd), begin);
-
-                    else
-                    {
-                        log(logBuf, "%s, could not join as %s", getCmdStr(cmd), begin);
-                        sendSetNameMsg = true;
-                    }
-
-                    break;
-                }
-                case Cmd::Simulation:
-                {
-                    // @ !!! we are not validating the data
-
-                    const char* buf = begin;
-
-                    sscanf(buf, "%f", &sim.timeToStart_);
-                    gotoNextWord(&buf, 1);
-
-                    int numPlayers;
-                    sscanf(buf, "%d", &numPlayers);
-                    gotoNextWord(&buf, 1);
-
-                    sim.players_.resize(numPlayers);
-                    assert(numPlayers == sim.players_.size());
-
-                    for(int i = 0; i < numPlayers; ++i)
-                    {
-                        Player& p = sim.players_[i];
-
-                        sscanf(buf, "%f %f %f %d %f %d %d %s %f %d",
-                            &p.pos.x, &p.pos.y, &p.vel, &p.dir, &p.dropCooldown, &p.hp, &p.score,
-                            p.name, &p.dmgTimer, &p.prevDir);
-
-                        gotoNextWord(&buf, 10);
-
-                    }
-
-                    sim.bombs_.clear();
-                    int numBombs;
-                    sscanf(buf, "%d", &numBombs);
-                    gotoNextWord(&buf, 1);
-
-                    for(int i = 0; i < numBombs; ++i)
-                    {
-                        Bomb b;
-
-                        sscanf(buf, "%d %d %d %f %d %d ",
-                                &b.tile.x, &b.tile.y, &b.range, &b.timer, &b.playerIdxs[0],
-                                &b.playerIdxs[1]);
-
-                        sim.bombs_.pushBack(b);
-
-                        gotoNextWord(&buf, 6);
-                    }
-
-                    int numExploEvents;
-                    sscanf(buf, "%d", &numExploEvents);
-                    gotoNextWord(&buf, 1);
-
-                    for(int i = 0; i < numExploEvents; ++i)
-                    {
-                        ExploEvent e;
-                        sscanf(buf, "%d %d %d", &e.tile.x, &e.tile.y, &e.type);
-                        exploEvents.pushBack(e);
-                        gotoNextWord(&buf, 3);
-                    }
-
-                    break;
-                }
-                case Cmd::InitTileData:
-                {
-                    newGame = true;
-
-                    // @ !!! we are not validating the data
-
-                    const char* ptr = begin;
-
-                    for(int i = 0; i < Simulation::MapSize * Simulation::MapSize; ++i)
-                    {
-                        sim.tiles_[0][i] = *ptr - 48; // converting from ascii
-                        ptr += 2;
-                    }
-                }
-            }
-        }
-
-        const int numToFree = end - recvBuf.data();
-        memmove(recvBuf.data(), recvBuf.data() + numToFree, recvBufNumUsed - numToFree);
-        recvBufNumUsed -= numToFree;
-    }
-
-    // send
-    if(!hasToReconnect && sendBuf.size())
-    {
-        const int rc = send(sockfd, sendBuf.data(), sendBuf.size(), 0);
-
-        if(rc == -1)
-        {
-            log(logBuf, "send() failed: %s", strerror(errno));
-            hasToReconnect = true;
-        }
-        else
-            sendBuf.erase(0, rc);
-    }
-
-    // update the tiles based on the exploEvents
-    // not inside Cmd::Simulation: because it is inside a loop
-    // we want to iterate over all exploEvents just once
-
-    if(!newGame) // so we don't override new map (server called sim.setNewGame())
-    {
-        for(ExploEvent& e: exploEvents)
-        {
-            if(e.type == ExploEvent::Crate)
-                sim.tiles_[e.tile.y][e.tile.x] = 0;
-        }
-    }
-}
-
-} // netcode
+#include <time.h>
 
 // copuled to the explosion texture asset
 Anim createExplosionAnim()
@@ -602,7 +147,7 @@ GameScene::GameScene()
 
     emitter_.spawn.size = vec2(5.f);
     emitter_.spawn.pos = vec2(210.f);
-    assert(emitter_.spawn.pos.x <= (Simulation::MapSize - 1) * Simulation::tileSize_);
+    assert(emitter_.spawn.pos.x <= (Simulation::LegacyMapSize - 1) * Simulation::tileSize_);
     emitter_.spawn.hz = 100.f;
     emitter_.particleRanges.life = {3.f, 6.f};
     emitter_.particleRanges.size = {0.25f, 2.f};
@@ -662,6 +207,7 @@ GameScene::GameScene()
     for(int i = 0; i < numActive; ++i)
         sprintf(offlineSim_.players_[i].name, "player%d", i);
 
+    offlineSim_.rng_.setSeed(time(nullptr));
     offlineSim_.setNewGame();
 }
 
@@ -685,8 +231,8 @@ void GameScene::processInput(const Array<WinEvent>& events)
     for(Action& action: actions_)
         action.drop = false;
 
-    const bool gameStarted =  netClient_.inGame ? (netClient_.sim.timeToStart_ <= 0.f) :
-        (offlineSim_.timeToStart_ <= 0.f);
+    const Simulation& sim = netClient_.inGame ? netClient_.getDisplaySim() : offlineSim_;
+    const bool gameStarted = sim.timeToStart_ <= 0.f;
 
     if(!gameStarted)
         showScore_ = false;
@@ -722,7 +268,7 @@ void GameScene::processInput(const Array<WinEvent>& events)
         }
     }
 
-    // @TODO: do the simulation on the client even if playing online (interpolation)
+    // online the input is sent (and predicted) in NetClient::update()
     if(netClient_.inGame)
         return;
 
@@ -737,19 +283,14 @@ void GameScene::processInput(const Array<WinEvent>& events)
         else if(input == InputType::Player2)
             offlineSim_.processPlayerInput(actions_[1], offlineSim_.players_[idx].name);
 
-        else if(input == InputType::Bot)
-            offlineSim_.updateAndProcessBotInput(offlineSim_.players_[idx].name, frame_.time);
-        else
+        // bots are updated in update(), once per simulation step
+        else if(input != InputType::Bot)
             continue;
 
         ++idx;
     }
 }
 
-// @TODO: client-side prediction
-// we need to create another Simulation: predictionSim_
-// don't push explo events in predictionSim_.update()
-
 void GameScene::update()
 {
     exploEvents_.clear();
@@ -757,12 +298,33 @@ void GameScene::update()
     netClient_.update(frame_.time, nameToSetBuf_, exploEvents_, actions_[0]);
 
     if(!netClient_.inGame)
-        offlineSim_.update(frame_.time, exploEvents_);
+    {
+        const int numSteps = offlineStep_.advance(frame_.time);
+
+        for(int step = 0; step < numSteps; ++step)
+        {
+            int idx = 0;
+            for(int input: inputs_)
+            {
+                if(input == InputType::Bot)
+                {
+                    offlineSim_.updateAndProcessBotInput(offlineSim_.players_[idx].name,
+                                                         offlineStep_.stepDt);
+                }
+                else if(input != InputType::Player1 && input != InputType::Player2)
+                    continue;
+
+                ++idx;
+            }
+
+            offlineSim_.update(offlineStep_.stepDt, exploEvents_);
+        }
+    }
 
     emitter_.update(frame_.time);
 
     {
-        const Simulation& sim = netClient_.inGame ? netClient_.sim : offlineSim_;
+        const Simulation& sim = netClient_.inGame ? netClient_.getDisplaySim() : offlineSim_;
 
         for(int i = 0; i < sim.players_.size(); ++i)
         {
@@ -811,39 +373,41 @@ void GameScene::update()
             e.anim.frameDt *= 1.5f;
             e.color = {0.1f, 0.1f, 0.1f, 0.2f};
         }
-        
-        explosions_.pushBack(e);
+
+        // the oldest explosions stay, see rects_
+        if(explosions_.size() < explosions_.maxSize())
+            explosions_.pushBack(e);
     }
 }
 
 // this should be static global function
 void GameScene::render(const GLuint program)
 {
-    const Simulation& sim = netClient_.inGame ? netClient_.sim : offlineSim_; // ... there is
-    // to much implicit state
+    // ... there is to much implicit state
+    const Simulation& sim = netClient_.inGame ? netClient_.getDisplaySim() : offlineSim_;
     bindProgram(program);
 
     Camera camera;
     camera.pos = vec2(0.f);
-    camera.size = vec2(Simulation::MapSize * sim.tileSize_);
+    camera.size = vec2(sim.tiles_.width(), sim.tiles_.height()) * sim.tileSize_;
     camera = expandToMatchAspectRatio(camera, frame_.fbSize);
     uniform2f(program, "cameraPos", camera.pos);
     uniform2f(program, "cameraSize", camera.size);
 
     // tilemap
 
-    assert(Simulation::MapSize * Simulation::MapSize <= getSize(rects_));
+    tileRects_.resize(sim.tiles_.size());
 
-    for (int j = 0; j < Simulation::MapSize; ++j)
+    for (int j = 0; j < sim.tiles_.height(); ++j)
     {
-        for (int i = 0; i < Simulation::MapSize; ++i)
+        for (int i = 0; i < sim.tiles_.width(); ++i)
         {
-            Rect& rect = rects_[j * Simulation::MapSize + i];
+            Rect& rect = tileRects_[j * sim.tiles_.width() + i];
             rect.pos = vec2(i, j) * sim.tileSize_;
             rect.size = vec2(sim.tileSize_);
             rect.color = {1.f, 1.f, 1.f, 1.f};
 
-            switch (sim.tiles_[j][i])
+            switch (sim.tiles_.get(i, j))
             {
                 case 0: rect.texRect = {0.f, 0.f, 64.f, 64.f};   break;
                 case 1: rect.texRect = {64.f, 0.f, 64.f, 64.f};  break;
@@ -860,8 +424,8 @@ void GameScene::render(const GLuint program)
 
     uniform1i(program, "mode", FragmentMode::Texture);
     bindTexture(textures_.tile);
-    updateGLBuffers(glBuffers_, rects_, getSize(rects_));
-    renderGLBuffers(glBuffers_, getSize(rects_));
+    updateGLBuffers(glBuffers_, tileRects_.data(), tileRects_.size());
+    renderGLBuffers(glBuffers_, tileRects_.size());
 
     // bombs
 
@@ -1027,7 +591,7 @@ void GameScene::render(const GLuint program)
         snprintf(buffer, getSize(buffer), "%.3f", sim.timeToStart_);
         text.color = {1.f, 0.5f, 1.f, 0.8f};
         text.scale = 2.f;
-        text.pos = {(Simulation::MapSize * sim.tileSize_ - getTextSize(text, font_).x)
+        text.pos = {(sim.tiles_.width() * sim.tileSize_ - getTextSize(text, font_).x)
                     / 2.f, 5.f};
 
         const int count = writeTextToBuffer(text, font_, rects_, getSize(rects_));
@@ -1059,7 +623,8 @@ void GameScene::render(const GLuint program)
         }
 
         const vec2 textSize = getTextSize(text, font_);
-        text.pos = ( vec2(Simulation::MapSize) * sim.tileSize_ - textSize ) / 2.f;
+        const vec2 mapSize = vec2(sim.tiles_.width(), sim.tiles_.height()) * sim.tileSize_;
+        text.pos = (mapSize - textSize) / 2.f;
 
         // * background
         {
@@ -1145,6 +710,14 @@ void GameScene::render(const GLuint program)
         }
     }
 
+    // also used by "create room"
+    if(ImGui::InputInt2("map size (odd)", mapSize_, ImGuiInputTextFlags_EnterReturnsTrue) &&
+       Simulation::isValidMapSize(mapSize_[0], mapSize_[1]))
+    {
+        offlineSim_.setMapSize(mapSize_[0], mapSize_[1]);
+        offlineSim_.setNewGame();
+    }
+
     ImGui::Text("controls:\n"
                 "\n"
                 "   Esc    - display score\n"
@@ -1188,6 +761,10 @@ void GameScene::render(const GLuint program)
         }
     }
 
+    // reconnects with the other transport, see netcode::UdpLink
+    if(ImGui::Checkbox("UDP (lossy networks)", &netClient_.udp))
+        netClient_.hasToReconnect = true;
+
     if(ImGui::InputText("login name", inputNameBuf_, sizeof(inputNameBuf_),
                 ImGuiInputTextFlags_EnterReturnsTrue | ImGuiInputTextFlags_CharsNoBlank))
         // no blank because the serialization system on the server requires it
@@ -1202,18 +779,60 @@ void GameScene::render(const GLuint program)
         fputs(nameToSetBuf_, file);
         fclose(file);
 
-        netcode::addMsg(netClient_.sendBuf, netcode::Cmd::SetName, nameToSetBuf_);
+        netClient_.addMsg(netcode::Cmd::SetName, nameToSetBuf_);
     }
 
     ImGui::Spacing();
 
     if(ImGui::Button("add bot to game"))
-        addMsg(netClient_.sendBuf, netcode::Cmd::AddBot);
+        netClient_.addMsg(netcode::Cmd::AddBot);
 
     ImGui::SameLine();
 
     if(ImGui::Button("remove bot from game"))
-        addMsg(netClient_.sendBuf, netcode::Cmd::RemoveBot);
+        netClient_.addMsg(netcode::Cmd::RemoveBot);
+
+    // the other players are rendered this much in the past, see netcode::InterpolationBuffer
+    ImGui::SliderFloat("interpolation delay (s)", &netClient_.interpolationDelay, 0.f, 0.5f);
+    ImGui::SliderFloat("max extrapolation (s)", &netClient_.maxExtrapolation, 0.f, 0.25f);
+
+    ImGui::Spacing();
+
+    if(netClient_.roomName[0])
+        ImGui::Text("room: %s", netClient_.roomName);
+
+    if(ImGui::Button("refresh room list"))
+        netClient_.addMsg(netcode::Cmd::ListRooms);
+
+    for(int i = 0; i < netClient_.rooms.size(); ++i)
+    {
+        const netcode::RoomInfo& room = netClient_.rooms[i];
+
+        ImGui::PushID(i);
+
+        if(ImGui::Button("join"))
+            netClient_.addMsg(netcode::Cmd::JoinRoom, room.name);
+
+        ImGui::PopID();
+        ImGui::SameLine();
+        ImGui::Text("%s (%d/%d) %dx%d", room.name, room.numPlayers, int(MaxPlayers),
+                    room.mapWidth, room.mapHeight);
+    }
+
+    if(ImGui::InputText("create room", roomNameBuf_, sizeof(roomNameBuf_),
+                ImGuiInputTextFlags_EnterReturnsTrue | ImGuiInputTextFlags_CharsNoBlank))
+    {
+        char buf[64];
+
+        // the older servers don't know the map dimensions
+        if(netClient_.protocol == netcode::ProtocolVersion)
+            snprintf(buf, sizeof(buf), "%s %d %d", roomNameBuf_, mapSize_[0], mapSize_[1]);
+        else
+            snprintf(buf, sizeof(buf), "%s", roomNameBuf_);
+
+        netClient_.addMsg(netcode::Cmd::CreateRoom, buf);
+        roomNameBuf_[0] = '\0';
+    }
 
     ImGui::Spacing();
     ImGui::Text("netcode::Client log");
@@ -1226,7 +845,7 @@ void GameScene::render(const GLuint program)
     if(ImGui::InputText("##chatbuf", chatBuf_, sizeof(chatBuf_),
                 ImGuiInputTextFlags_EnterReturnsTrue))
     {
-        addMsg(netClient_.sendBuf, netcode::Cmd::Chat, chatBuf_);
+        netClient_.addMsg(netcode::Cmd::Chat, chatBuf_);
         chatBuf_[0] = '\0';
     }
 
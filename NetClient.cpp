@@ -0,0 +1,1082 @@
+// netcode::NetClient, it does not depend on the rendering (see loadgen.cpp)
+
+#include "Scene.hpp"
+#include <stdio.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <time.h>
+#include <atomic>
+
+namespace netcode
+{
+
+void log(Array<char>& buf, const char* fmt, ...)
+{
+    char bigbuf[1024]; // not static, the load generator logs from several threads
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(bigbuf, (sizeof bigbuf) - 1, fmt, args);
+    va_end(args);
+
+    int len = strlen(bigbuf);
+    bigbuf[len++] = '\n';
+
+    const int prevSize = buf.size();
+    buf.resize(len + prevSize);
+    memmove(buf.begin() + len, buf.begin(), prevSize);
+    memcpy(buf.begin(), bigbuf, len);
+
+    if(buf.size() > 9000)
+    {
+        buf.resize(9000);
+        buf.back() = '\0';
+    }
+}
+
+bool resolveHost(Array<char>& logBuf, const char* const host, const bool udp,
+                 HostAddrs& hostAddrs)
+{
+    hostAddrs.addrs.clear();
+    snprintf(hostAddrs.host, sizeof(hostAddrs.host), "%s", host);
+    hostAddrs.udp = udp;
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+
+    addrinfo* list;
+    {
+        // this block (domain name resolution)
+        const int ec = getaddrinfo(host, "3000", &hints, &list);
+        if(ec != 0)
+        {
+            log(logBuf, "getaddrinfo() failed: %s", gai_strerror(ec));
+            return false;
+        }
+    }
+
+    for(const addrinfo* it = list; it != nullptr; it = it->ai_next)
+    {
+        if(hostAddrs.addrs.size() == hostAddrs.addrs.maxSize())
+            break;
+
+        HostAddrs::Addr addr;
+        addr.family = it->ai_family;
+        addr.socktype = it->ai_socktype;
+        addr.protocol = it->ai_protocol;
+        memcpy(&addr.addr, it->ai_addr, it->ai_addrlen);
+        addr.addrLen = it->ai_addrlen;
+        hostAddrs.addrs.pushBack(addr);
+    }
+    freeaddrinfo(list);
+
+    return !hostAddrs.addrs.empty();
+}
+
+// returns socket descriptior, -1 if failed
+// if succeeded you have to free the socket yourself
+// the socket is non-blocking, the TCP handshake can be in progress, see finishConnect(); only
+// the first address that does not fail at once is used
+// udp - the socket is only bound to the server address (no handshake), see UdpLink
+// hostAddrs - resolved again only if it is empty or for another host / transport
+int connect(Array<char>& logBuf, HostAddrs& hostAddrs, const char* host, const bool udp)
+{
+    if(hostAddrs.addrs.empty() || hostAddrs.udp != udp || strcmp(hostAddrs.host, host) != 0)
+    {
+        if(!resolveHost(logBuf, host, udp, hostAddrs))
+            return -1;
+    }
+
+    int sockfd;
+
+    const HostAddrs::Addr* it;
+    for(it = hostAddrs.addrs.begin(); it != hostAddrs.addrs.end(); ++it)
+    {
+        sockfd = socket(it->family, it->socktype, it->protocol);
+        if(sockfd == -1)
+        {
+            log(logBuf, "socket() failed: %s", strerror(errno));
+            continue;
+        }
+
+        if(fcntl(sockfd, F_SETFL, O_NONBLOCK) == -1)
+        {
+            close(sockfd);
+            log(logBuf, "fcntl() failed: %s", strerror(errno));
+            continue;
+        }
+
+        if(connect(sockfd, (const sockaddr*)&it->addr, it->addrLen) == -1 &&
+           errno != EINPROGRESS)
+        {
+            close(sockfd);
+            log(logBuf, "connect() failed: %s", strerror(errno));
+            continue;
+        }
+
+        char name[INET6_ADDRSTRLEN];
+        inet_ntop(it->family, get_in_addr((const sockaddr*)&it->addr), name, sizeof(name));
+
+        log(logBuf, "connecting to %s%s", name, udp ? " (UDP)" : "");
+        break;
+    }
+
+    if(it == hostAddrs.addrs.end())
+    {
+        log(logBuf, "connection procedure failed");
+        return -1;
+    }
+
+    if(!udp)
+    {
+        const int option = 1;
+        if(setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &option, sizeof(option)) == -1)
+        {
+            close(sockfd);
+            log(logBuf, "setsockopt() (TCP_NODELAY) failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    return sockfd;
+}
+
+// returns 1 if the connect() has succeeded, 0 if it is still in progress, -1 if it failed
+int finishConnect(Array<char>& logBuf, const int sockfd)
+{
+    pollfd pfd = {sockfd, POLLOUT, 0};
+    const int rc = poll(&pfd, 1, 0);
+
+    if(rc == -1)
+    {
+        log(logBuf, "poll() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if(rc == 0)
+        return 0;
+
+    int error;
+    socklen_t len = sizeof(error);
+
+    if(getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+        error = errno;
+
+    if(error)
+    {
+        log(logBuf, "connect() failed: %s", strerror(error));
+        return -1;
+    }
+
+    return 1;
+}
+
+NetClient::NetClient()
+{
+    sendBuf.reserve(500);
+    recvBuf.resize(500);
+    logBuf.reserve(10000);
+    logBuf.pushBack('\0'); // terminate with null
+
+    // so we have valid data to display during the time when inGame is set to
+    // true but no Simulation data arrived from the server yet
+    sim.setNewGame(); 
+    predictionSim.setNewGame();
+    displaySim.setNewGame();
+}
+
+void NetClient::ping()
+{
+    pingRequested = true;
+}
+
+void NetClient::addMsg(const int cmd, const char* const payload)
+{
+    if(protocol == ProtocolVersion)
+        addBinaryMsg(sendBuf, cmd, payload, strlen(payload) + 1);
+    else
+        netcode::addMsg(sendBuf, cmd, payload);
+}
+
+const Simulation& NetClient::getDisplaySim() const
+{
+    return protocol == ProtocolVersion ? displaySim : sim;
+}
+
+void InterpolationBuffer::add(const int tick, const FixedArray<Player, MaxPlayers>& players)
+{
+    if(count)
+    {
+        const int newestTick = entries[newest].tick;
+
+        if(tick == newestTick)
+            return;
+
+        if(tick < newestTick)
+            count = 0;
+    }
+
+    newest = (newest + 1) % Size;
+    entries[newest].tick = tick;
+    entries[newest].players = players;
+    count = min(count + 1, int(Size));
+}
+
+const InterpolationBuffer::Entry& InterpolationBuffer::get(const int i) const
+{
+    assert(i >= 0 && i < count);
+    return entries[(newest - count + 1 + i + Size) % Size];
+}
+
+// returns false if the player is not in the entry or has moved by more than a tile
+static bool findNearby(const InterpolationBuffer::Entry& entry, const Player& player,
+                       vec2& pos)
+{
+    for(const Player& p: entry.players)
+    {
+        if(strcmp(p.name, player.name) == 0)
+        {
+            pos = p.pos;
+            return fabsf(pos.x - player.pos.x) + fabsf(pos.y - player.pos.y) <=
+                   Simulation::tileSize_;
+        }
+    }
+
+    return false;
+}
+
+void InterpolationBuffer::sample(const float tick, const float maxExtrapolation,
+                                 FixedArray<Player, MaxPlayers>& players) const
+{
+    assert(count);
+    const Entry& last = get(count - 1);
+
+    if(tick >= last.tick)
+    {
+        players = last.players;
+
+        if(count < 2)
+            return;
+
+        // the velocity between the last two entries
+
+        const Entry& prev = get(count - 2);
+        const float numTicks = min(tick - last.tick, maxExtrapolation);
+
+        for(Player& p: players)
+        {
+            vec2 prevPos;
+
+            if(findNearby(prev, p, prevPos))
+                p.pos += (p.pos - prevPos) * (numTicks / (last.tick - prev.tick));
+        }
+
+        return;
+    }
+
+    // the first entry after tick (the last one is)
+    int i = 0;
+
+    while(get(i).tick <= tick)
+        ++i;
+
+    if(i == 0)
+    {
+        players = get(0).players;
+        return;
+    }
+
+    const Entry& a = get(i - 1);
+    const Entry& b = get(i);
+    const float alpha = (tick - a.tick) / (b.tick - a.tick);
+    players = a.players;
+
+    for(Player& p: players)
+    {
+        vec2 nextPos;
+
+        if(findNearby(b, p, nextPos))
+            p.pos += (nextPos - p.pos) * alpha;
+    }
+}
+
+void NetClient::updateDisplaySim(const float dt)
+{
+    displaySim.tiles_.assign(predictionSim.tiles_);
+    displaySim.players_ = predictionSim.players_;
+    displaySim.bombs_ = predictionSim.bombs_;
+    displaySim.timeToStart_ = predictionSim.timeToStart_;
+
+    if(!interpolation.count)
+        return;
+
+    const float stepDt = predictionStep.stepDt;
+    const float targetTick = interpolation.get(interpolation.count - 1).tick -
+                             interpolationDelay / stepDt;
+
+    // renderTick runs at most 10% faster or slower to catch up with the target (the newest
+    // tick moves in steps), it jumps if it is too far (the first snapshots, a stall)
+
+    renderTick += dt / stepDt;
+    const float error = targetTick - renderTick;
+
+    if(fabsf(error) > 0.25f / stepDt)
+        renderTick = targetTick;
+    else
+        renderTick += max(-0.1f, min(0.1f, error * 0.05f)) * dt / stepDt;
+
+    FixedArray<Player, MaxPlayers> remotePlayers;
+    interpolation.sample(renderTick, maxExtrapolation / stepDt, remotePlayers);
+
+    // the local player stays predicted
+
+    for(Player& player: displaySim.players_)
+    {
+        if(strcmp(player.name, inGameName) == 0)
+            continue;
+
+        for(const Player& remote: remotePlayers)
+        {
+            if(strcmp(remote.name, player.name) == 0)
+                player = remote;
+        }
+    }
+}
+
+void NetClient::rewindPrediction(const unsigned ackedInputSeq)
+{
+    Simulation& pred = predictionSim;
+
+    if(pred.tiles_.width() != sim.tiles_.width() || pred.tiles_.height() != sim.tiles_.height())
+        pred.setMapSize(sim.tiles_.width(), sim.tiles_.height());
+
+    pred.tiles_.assign(sim.tiles_);
+    pred.players_ = sim.players_;
+    pred.bombs_ = sim.bombs_;
+    pred.timeToStart_ = sim.timeToStart_;
+    pred.tick_ = sim.tick_;
+    pred.rebuildOccupancy();
+
+    // the server has applied these inputs already (seq wraps around after years of play)
+
+    int numAcked = 0;
+
+    while(numAcked < pendingInputs.size() &&
+          int(pendingInputs[numAcked].seq - ackedInputSeq) <= 0)
+    {
+        ++numAcked;
+    }
+
+    for(int i = numAcked; i < pendingInputs.size(); ++i)
+        pendingInputs[i - numAcked] = pendingInputs[i];
+
+    pendingInputs.resize(pendingInputs.size() - numAcked);
+
+    // replay the rest
+
+    const bool hasPlayer = pred.findPlayer(inGameName) != -1;
+
+    for(const PendingInput& input: pendingInputs)
+    {
+        if(hasPlayer)
+            pred.processPlayerInput(input.action, inGameName);
+
+        for(int step = 0; step < input.numSteps; ++step)
+        {
+            predictionEvents.clear();
+            pred.update(predictionStep.stepDt, predictionEvents);
+        }
+    }
+}
+
+NetClient::~NetClient()
+{
+    if(sockfd != -1)
+        close(sockfd);
+}
+
+// count - move by this many words
+void gotoNextWord(const char** buf, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        while(**buf != ' ')
+            ++(*buf);
+
+        ++(*buf);
+    }
+}
+
+void NetClient::update(const float dt, const char* name,
+                       FixedArray<ExploEvent, MaxExploEvents>& exploEvents, Action& playerAction)
+{
+    const bool predict = inGame && protocol == ProtocolVersion;
+
+    bool newInput = false;
+
+    if(inGame)
+    {
+        inputTimer += dt;
+        const int bits = packAction(playerAction);
+
+        if(bits != inputBits || inputTimer >= predictionStep.stepDt)
+        {
+            inputBits = bits;
+            inputTimer = 0.f;
+            newInput = true;
+        }
+    }
+
+    if(newInput && predict)
+    {
+        ++inputSeq;
+
+        if(pendingInputs.size() == pendingInputs.maxSize())
+        {
+            for(int i = 1; i < pendingInputs.size(); ++i)
+                pendingInputs[i - 1] = pendingInputs[i];
+
+            pendingInputs.popBack();
+        }
+
+        pendingInputs.pushBack({inputSeq, playerAction, 0});
+
+        // the newest input and the previous ones the server has not acknowledged
+        Action actions[InputRedundancy];
+        const int numActions = min(pendingInputs.size(), int(InputRedundancy));
+
+        for(int i = 0; i < numActions; ++i)
+            actions[i] = pendingInputs[pendingInputs.size() - numActions + i].action;
+
+        Array<char>& payload = inputPayload;
+        payload.clear();
+        encodePlayerInput(payload, inputSeq, actions, numActions);
+        addBinaryMsg(sendBuf, Cmd::PlayerInput, payload.data(), payload.size());
+    }
+    else if(newInput)
+    {
+        char buf[32];
+        sprintf(buf, "%d %d %d %d %d", playerAction.up, playerAction.down, playerAction.left,
+                playerAction.right, playerAction.drop);
+
+        addMsg(Cmd::PlayerInput, buf);
+    }
+
+    // time managment
+    netTime += dt;
+    timerAlive += dt;
+    timerReconnect += dt;
+    timerSendSetNameMsg += dt;
+
+    if(hasToReconnect)
+    {
+        inGame = false;
+
+        if(timerReconnect >= timerReconnectMax)
+        {
+            timerReconnect = 0.f;
+
+            // the previous connection was lost or the handshake has not finished in time
+            if(sockfd != -1)
+            {
+                close(sockfd);
+
+                if(connecting)
+                    log(logBuf, "connect() timed out");
+
+                else if(!connected)
+                    log(logBuf, "no %s response", getCmdStr(Cmd::Protocol));
+
+                if(connected)
+                    ++numDisconnects;
+                else
+                    ++numConnectFailures;
+            }
+
+            assert(strlen(host));
+            sockfd = connect(logBuf, hostAddrs, host, udp);
+            connecting = sockfd != -1;
+            connected = false;
+
+            if(sockfd == -1)
+                ++numConnectFailures;
+        }
+
+        const int rc = connecting ? finishConnect(logBuf, sockfd) : 0;
+
+        if(rc == -1)
+        {
+            close(sockfd);
+            sockfd = -1;
+            connecting = false;
+            ++numConnectFailures;
+        }
+        else if(rc == 1)
+        {
+            log(logBuf, "connected, waiting for %s", getCmdStr(Cmd::Protocol));
+            connecting = false;
+            serverAlive = true;
+            timerAlive = timerAliveMax;
+            hasToReconnect = false;
+            sendBuf.clear();
+            sendSetNameMsg = true;
+            protocol = 0;
+            snapshots.clear();
+            snapshotToAck = 0;
+            roomName[0] = '\0';
+            rooms.clear();
+            inputSeq = 0;
+            inputBits = -1;
+            pendingInputs.clear();
+            interpolation.clear();
+            newestSnapshotTick = 0;
+            pingRequested = false;
+            pingTime = -1.0;
+
+            // every connection of the process has its own UDP id and (reproducible)
+            // delays and losses; atomic, the load generator has several threads of clients
+            static std::atomic<unsigned> numConnections(0);
+            const unsigned connectionIdx = ++numConnections;
+
+            if(udp)
+            {
+                // a new id for every connection, the server might still have the old one
+                static const unsigned idBase =
+                    Rng((unsigned long long)time(nullptr) << 20 ^ getpid()).next();
+
+                unsigned id = idBase + connectionIdx;
+                id += !id; // 0 is not a valid id
+
+                link.reset(id, 0);
+            }
+
+            shim.reset(netConditions, (unsigned long long)netConditions.seed << 32 |
+                       connectionIdx, udp);
+
+            // must be the first message, the server will respond with the version it
+            // agreed to (0 if it does not support ours; old servers ignore it)
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%d", ProtocolVersion);
+            netcode::addMsg(sendBuf, Cmd::Protocol, buf);
+        }
+    }
+
+    if(sendSetNameMsg && (timerSendSetNameMsg >= timerReconnectMax))
+    {
+        sendSetNameMsg = false;
+        timerSendSetNameMsg = 0.f;
+
+        int len = strlen(name);
+        assert(len < Player::NameBufSize);
+        assert(len);
+        addMsg(Cmd::SetName, name);
+    }
+
+    // update
+    if(!hasToReconnect)
+    {
+        if(timerAlive > timerAliveMax)
+        {
+            timerAlive = 0.f;
+
+            if(serverAlive)
+            {
+                serverAlive = false;
+                ping();
+            }
+            else
+            {
+                hasToReconnect = true;
+                log(logBuf, "no PONG response from server, will try to reconnect\n");
+            }
+        }
+
+        // sent in this update(), the rtt does not include the time to the next one
+        if(pingRequested)
+        {
+            pingRequested = false;
+
+            if(pingTime < 0.0)
+            {
+                pingTime = netTime;
+                addMsg(Cmd::Ping);
+            }
+        }
+    }
+
+    // receive
+    if(!hasToReconnect && udp)
+    {
+        while(true)
+        {
+            netScratch.resize(UdpMaxDatagram);
+            const int rc = recv(sockfd, netScratch.data(), netScratch.size(), 0);
+
+            if(rc == -1)
+            {
+                // ECONNREFUSED if the server is not running (ICMP port unreachable)
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    log(logBuf, "recv() failed: %s", strerror(errno));
+                    hasToReconnect = true;
+                }
+
+                break;
+            }
+
+            numBytesReceived += rc;
+            link.receive(netScratch.data(), rc, netTime, recvBuf, recvBufNumUsed);
+        }
+    }
+    else if(!hasToReconnect)
+    {
+        while(true)
+        {
+            const int numFree = recvBuf.size() - recvBufNumUsed;
+            const int rc = recv(sockfd, recvBuf.data() + recvBufNumUsed, numFree, 0);
+
+            if(rc == -1)
+            {
+                if(errno != EAGAIN || errno != EWOULDBLOCK)
+                {
+                    log(logBuf, "recv() failed: %s", strerror(errno));
+                    hasToReconnect = true;
+                }
+
+                break;
+            }
+            else if(rc == 0)
+            {
+                log(logBuf, "server has closed the connection\n");
+                hasToReconnect = true;
+                break;
+            }
+            else
+            {
+                numBytesReceived += rc;
+                recvBufNumUsed += rc;
+
+                if(recvBufNumUsed < recvBuf.size())
+                    break;
+
+                recvBuf.resize(recvBuf.size() * 2);
+
+                // the biggest message is a binary one (Cmd::InitTileData of a big map)
+                if(recvBuf.size() > 2 * (BinaryMsgHeaderSize + BinaryMsgMaxPayload))
+                {
+                    log(logBuf, "recvBuf BIG SIZE ISSUE, clearing the buffer\n");
+                    recvBufNumUsed = 0;
+                }
+            }
+        }
+    }
+
+    bool newGame = false;
+    bool rewind = false; // a new snapshot or a new map
+    unsigned ackedInputSeq = 0;
+
+    // process received data
+    {
+        const char* it = recvBuf.data();
+        const char* const bufEnd = recvBuf.data() + recvBufNumUsed;
+
+        while(true)
+        {
+            Msg msg;
+            {
+                const int numBytes = parseMsg(it, bufEnd - it, msg);
+
+                if(numBytes == 0) break;
+                it += numBytes;
+            }
+
+            const int cmd = msg.cmd;
+            const char* const begin = msg.payload;
+
+            //printf("received msg: '%s'\n", begin);
+
+            // only Cmd::Simulation, Cmd::InitTileData and Cmd::ExploEvents have a binary form
+            if(msg.binary && cmd != Cmd::Simulation && cmd != Cmd::InitTileData &&
+               cmd != Cmd::ExploEvents)
+            {
+                log(logBuf, "WARNING unexpected binary message (cmd %d)", cmd);
+                continue;
+            }
+
+            switch(cmd)
+            {
+                case 0:
+                    log(logBuf, "WARNING unknown command received: %s", begin);
+                    break;
+
+                case Cmd::Ping:
+                    addMsg(Cmd::Pong);
+                    break;
+
+                case Cmd::Pong:
+                    serverAlive = true;
+
+                    if(pingTime >= 0.0)
+                    {
+                        rtt = netTime - pingTime;
+                        pingTime = -1.0;
+                    }
+
+                    break;
+
+                case Cmd::Protocol:
+                    protocol = atoi(begin);
+                    log(logBuf, "%s %d", getCmdStr(cmd), protocol);
+
+                    if(!connected)
+                    {
+                        connected = true;
+                        ++numConnects;
+                    }
+
+                    break;
+
+                case Cmd::Chat:
+                    log(logBuf, begin);
+                    break;
+
+                case Cmd::GameFull:
+                {
+                    log(logBuf, "%s", getCmdStr(cmd));
+                    sendSetNameMsg = true;
+                    break;
+                }
+
+                case Cmd::NameOk:
+                {
+                    log(logBuf, "%s %s", getCmdStr(cmd), begin);
+                    inGame = true;
+                    int len = strlen(begin);
+                    assert(len < Player::NameBufSize);
+                    memcpy(inGameName, begin, len);
+                    inGameName[len] = '\0';
+                    break;
+                }
+
+                case Cmd::MustRename:
+                {
+                    if(inGame)
+                        log(logBuf, "%s, could not rename to %s", getCmdStr(cmd), begin);
+
+                    else
+                    {
+                        log(logBuf, "%s, could not join as %s", getCmdStr(cmd), begin);
+                        sendSetNameMsg = true;
+                    }
+
+                    break;
+                }
+                case Cmd::Simulation:
+                {
+                    if(msg.binary)
+                    {
+                        unsigned seq;
+                        const Snapshot* const snapshot = decodeSimulation(begin, msg.size,
+                                                         snapshots, exploEvents, seq);
+
+                        // a UDP snapshot can arrive after a newer one
+                        if(snapshot && snapshot->tick <= newestSnapshotTick)
+                            break;
+
+                        if(snapshot)
+                        {
+                            newestSnapshotTick = snapshot->tick;
+                            applySnapshot(sim, *snapshot);
+                            ++numSnapshots;
+                            interpolation.add(snapshot->tick, snapshot->players);
+                            snapshotToAck = snapshot->tick;
+                            rewind = true;
+                            ackedInputSeq = seq;
+                        }
+                        else
+                        {
+                            log(logBuf, "WARNING malformed %s message", getCmdStr(cmd));
+                            // request a full snapshot
+                            addMsg(Cmd::SnapshotAck, "0");
+                        }
+
+                        break;
+                    }
+
+                    // @ !!! we are not validating the data
+
+                    const char* buf = begin;
+
+                    sscanf(buf, "%f", &sim.timeToStart_);
+                    gotoNextWord(&buf, 1);
+
+                    int numPlayers;
+                    sscanf(buf, "%d", &numPlayers);
+                    gotoNextWord(&buf, 1);
+
+                    sim.players_.resize(numPlayers);
+                    assert(numPlayers == sim.players_.size());
+
+                    for(int i = 0; i < numPlayers; ++i)
+                    {
+                        Player& p = sim.players_[i];
+
+                        sscanf(buf, "%f %f %f %d %f %d %d %s %f %d",
+                            &p.pos.x, &p.pos.y, &p.vel, &p.dir, &p.dropCooldown, &p.hp, &p.score,
+                            p.name, &p.dmgTimer, &p.prevDir);
+
+                        gotoNextWord(&buf, 10);
+
+                    }
+
+                    sim.bombs_.clear();
+                    int numBombs;
+                    sscanf(buf, "%d", &numBombs);
+                    gotoNextWord(&buf, 1);
+
+                    for(int i = 0; i < numBombs; ++i)
+                    {
+                        Bomb b;
+
+                        sscanf(buf, "%d %d %d %f %d %d ",
+                                &b.tile.x, &b.tile.y, &b.range, &b.timer, &b.playerIdxs[0],
+                                &b.playerIdxs[1]);
+
+                        sim.bombs_.pushBack(b);
+
+                        gotoNextWord(&buf, 6);
+                    }
+
+                    sim.rebuildOccupancy();
+
+                    int numExploEvents;
+                    sscanf(buf, "%d", &numExploEvents);
+                    gotoNextWord(&buf, 1);
+
+                    for(int i = 0; i < numExploEvents; ++i)
+                    {
+                        ExploEvent e;
+                        sscanf(buf, "%d %d %d", &e.tile.x, &e.tile.y, &e.type);
+                        exploEvents.pushBack(e);
+                        gotoNextWord(&buf, 3);
+                    }
+
+                    break;
+                }
+                case Cmd::JoinRoom:
+                {
+                    log(logBuf, "%s %s", getCmdStr(cmd), begin);
+                    snprintf(roomName, sizeof(roomName), "%s", begin);
+                    // the server won't use the previous room snapshots as the baseline
+                    snapshots.clear();
+                    snapshotToAck = 0;
+                    newestSnapshotTick = 0;
+                    interpolation.clear();
+                    break;
+                }
+
+                case Cmd::RoomError:
+                    log(logBuf, "%s %s", getCmdStr(cmd), begin);
+                    break;
+
+                case Cmd::ExploEvents:
+                {
+                    if(!msg.binary || !decodeExploEvents(begin, msg.size, exploEvents))
+                        log(logBuf, "WARNING malformed %s message", getCmdStr(cmd));
+
+                    break;
+                }
+
+                case Cmd::RoomList:
+                {
+                    static_assert(RoomNameBufSize == 20, "update the sscanf format");
+                    rooms.clear();
+                    const char* buf = begin;
+
+                    // protocol 0 servers don't send the map dimensions
+                    const int numWords = protocol == ProtocolVersion ? 4 : 2;
+
+                    while(*buf != '\0' && rooms.size() < rooms.maxSize())
+                    {
+                        RoomInfo info;
+                        info.mapWidth = Simulation::LegacyMapSize;
+                        info.mapHeight = Simulation::LegacyMapSize;
+
+                        if(sscanf(buf, "%19s %d %d %d", info.name, &info.numPlayers,
+                                  &info.mapWidth, &info.mapHeight) < numWords)
+                            break;
+
+                        rooms.pushBack(info);
+                        gotoNextWord(&buf, numWords);
+                    }
+
+                    break;
+                }
+
+                case Cmd::InitTileData:
+                {
+                    if(msg.binary)
+                    {
+                        if(decodeTileData(begin, msg.size, sim))
+                        {
+                            newGame = true;
+                            rewind = true;
+                        }
+                        else
+                            log(logBuf, "WARNING malformed %s message", getCmdStr(cmd));
+
+                        break;
+                    }
+
+                    // @ !!! we are not validating the tile values
+
+                    const int size = Simulation::LegacyMapSize;
+
+                    if(int(strlen(begin)) < size * size * 2 - 1)
+                    {
+                        log(logBuf, "WARNING not enough tile data");
+                        break;
+                    }
+
+                    newGame = true;
+
+                    if(sim.tiles_.width() != size || sim.tiles_.height() != size)
+                        sim.setMapSize(size, size);
+
+                    const char* ptr = begin;
+
+                    for(int i = 0; i < size * size; ++i)
+                    {
+                        sim.tiles_.set(i % size, i / size, *ptr - 48); // converting from ascii
+                        ptr += 2;
+                    }
+                }
+            }
+        }
+
+        const int numToFree = it - recvBuf.data();
+        memmove(recvBuf.data(), recvBuf.data() + numToFree, recvBufNumUsed - numToFree);
+        recvBufNumUsed -= numToFree;
+    }
+
+    // acknowledge only the newest snapshot, it will be the baseline for the next ones
+    if(snapshotToAck)
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", snapshotToAck);
+        addMsg(Cmd::SnapshotAck, buf);
+        snapshotToAck = 0;
+    }
+
+    // send
+    if(!hasToReconnect)
+    {
+        int rc = 0;
+
+        // a message can wrap around the end of the ring, it is copied first
+        if((udp || shim.isActive()) && sendBuf.size())
+        {
+            Array<char>& msgs = netScratch;
+            RingBuffer::Span spans[2];
+            const int numSpans = sendBuf.getReadSpans(spans);
+            msgs.resize(sendBuf.size());
+            int offset = 0;
+
+            for(int i = 0; i < numSpans; ++i)
+            {
+                memcpy(msgs.data() + offset, spans[i].data, spans[i].size);
+                offset += spans[i].size;
+            }
+
+            sendBuf.clear();
+
+            if(udp)
+                link.addMsgs(msgs.data(), msgs.size());
+            else
+                shim.push(msgs.data(), msgs.size(), netTime);
+        }
+
+        if(udp)
+        {
+            int size;
+
+            while( (size = link.buildPacket(netScratch, netTime)) )
+            {
+                if(shim.isActive())
+                    shim.push(netScratch.data(), size, netTime);
+
+                else if(send(sockfd, netScratch.data(), size, 0) != -1)
+                    numBytesSent += size;
+
+                // a full socket buffer is a packet loss
+                else if(errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    rc = -1;
+                    break;
+                }
+            }
+        }
+        else if(sendBuf.size())
+            rc = sendBuffer(sockfd, sendBuf);
+
+        if(rc != -1 && shim.isActive())
+            rc = shim.send(sockfd, netTime);
+
+        if(rc > 0)
+            numBytesSent += rc;
+
+        if(rc == -1)
+        {
+            log(logBuf, "send() failed: %s", strerror(errno));
+            hasToReconnect = true;
+        }
+    }
+
+    // update the tiles based on the exploEvents
+    // not inside Cmd::Simulation: because it is inside a loop
+    // we want to iterate over all exploEvents just once
+
+    if(!newGame) // so we don't override new map (server called sim.setNewGame())
+    {
+        for(ExploEvent& e: exploEvents)
+        {
+            if(e.type == ExploEvent::Crate && sim.isOnMap(e.tile))
+                sim.tiles_.set(e.tile.x, e.tile.y, 0);
+        }
+    }
+
+    // client-side prediction, the local player input is visible in this frame
+
+    if(predict)
+    {
+        if(rewind)
+            rewindPrediction(ackedInputSeq);
+
+        else if(newInput && predictionSim.findPlayer(inGameName) != -1)
+            predictionSim.processPlayerInput(pendingInputs.back().action, inGameName);
+
+        const int numSteps = predictionStep.advance(dt);
+
+        for(int step = 0; step < numSteps; ++step)
+        {
+            predictionEvents.clear();
+            predictionSim.update(predictionStep.stepDt, predictionEvents);
+        }
+
+        if(pendingInputs.size())
+            pendingInputs.back().numSteps += numSteps;
+
+        updateDisplaySim(dt);
+    }
+}
+
+} // netcode
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <string.h>
+#include <assert.h>
+
+// lock-free single producer single consumer queues
+// push() / write() must be called only from the producer thread, pop() / read() only from the
+// consumer thread; N must be a power of two
+
+template<typename T, int N>
+class SpscQueue
+{
+public:
+    static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+    // returns false if the queue is full
+    bool push(const T& t)
+    {
+        const unsigned tail = tail_.load(std::memory_order_relaxed);
+
+        if(tail - head_.load(std::memory_order_acquire) == N)
+            return false;
+
+        data_[tail & (N - 1)] = t;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // returns false if the queue is empty
+    bool pop(T& t)
+    {
+        const unsigned head = head_.load(std::memory_order_relaxed);
+
+        if(head == tail_.load(std::memory_order_acquire))
+            return false;
+
+        t = data_[head & (N - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // on separate cache lines, each one is written by a different thread
+    alignas(64) std::atomic<unsigned> head_ {0};
+    alignas(64) std::atomic<unsigned> tail_ {0};
+    alignas(64) T data_[N];
+};
+
+// variable size records, bytes written with one write() become visible to the consumer at once
+template<int N>
+class SpscByteQueue
+{
+public:
+    static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+    // all or nothing, returns false if there is not enough space
+    bool write(const void* data, int size)
+    {
+        const unsigned tail = tail_.load(std::memory_order_relaxed);
+
+        if(N - (tail - head_.load(std::memory_order_acquire)) < unsigned(size))
+            return false;
+
+        const int offset = tail & (N - 1);
+        const int first = size < N - offset ? size : N - offset;
+        memcpy(data_ + offset, data, first);
+        memcpy(data_, (const char*)data + first, size - first);
+
+        tail_.store(tail + size, std::memory_order_release);
+        return true;
+    }
+
+    int numReadable() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_relaxed);
+    }
+
+    // size must be <= numReadable(); data can be nullptr (skip)
+    void read(void* data, int size)
+    {
+        const unsigned head = head_.load(std::memory_order_relaxed);
+        assert(unsigned(size) <= tail_.load(std::memory_order_acquire) - head);
+
+        if(data)
+        {
+            const int offset = head & (N - 1);
+            const int first = size < N - offset ? size : N - offset;
+            memcpy(data, data_ + offset, first);
+            memcpy((char*)data + first, data_, size - first);
+        }
+
+        head_.store(head + size, std::memory_order_release);
+    }
+
+private:
+    alignas(64) std::atomic<unsigned> head_ {0};
+    alignas(64) std::atomic<unsigned> tail_ {0};
+    alignas(64) char data_[N];
+};
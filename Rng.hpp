@@ -0,0 +1,41 @@
+#pragma once
+
+#include <assert.h>
+
+// PCG32 (pcg-random.org): 64 bits of state, 32 bit output; the same seed gives the same
+// sequence on every platform, unlike rand()
+class Rng
+{
+public:
+    explicit Rng(unsigned long long seed = 0) {setSeed(seed);}
+
+    void setSeed(unsigned long long seed)
+    {
+        state_ = 0;
+        next();
+        state_ += seed;
+        next();
+    }
+
+    unsigned next()
+    {
+        const unsigned long long prev = state_;
+        state_ = prev * 6364136223846793005ull + Increment;
+        const unsigned xorShifted = ((prev >> 18) ^ prev) >> 27;
+        const unsigned rot = prev >> 59;
+        return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+    }
+
+    // [min, max]; multiply-shift, the bias is negligible for the ranges we use
+    int getInt(int min, int max)
+    {
+        assert(min <= max);
+        const unsigned long long range = (long long)max - min + 1;
+        return min + int((next() * range) >> 32);
+    }
+
+private:
+    static const unsigned long long Increment = 1442695040888963407ull; // must be odd
+
+    unsigned long long state_;
+};
@@ -1,12 +1,12 @@
 #pragma once
 
 #include "Array.hpp"
+#include "TileGrid.hpp"
+#include "Rng.hpp"
 #include "fmod/fmod.h"
 #include <float.h>
 #include <math.h>
 #include <sys/socket.h>
-#include <stack>
-#include <vector>
 
 template<typename T>
 inline T max(T a, T b) {return a > b ? a : b;}
@@ -234,9 +234,8 @@ struct Camera
 
 Camera expandToMatchAspectRatio(Camera camera, vec2 viewportSize);
 
-// [min, max]
+// [min, max], rand() based, for the effects only (Simulation has its own Rng)
 float getRandomFloat(float min, float max);
-int getRandomInt(int min, int max);
 
 class Scene
 {
@@ -392,6 +391,10 @@ struct ExploEvent
     int type;
 };
 
+// a bomb can't be dropped on another one; the explo events of the server catch up steps
+// are accumulated in one array
+enum {MaxBombs = 128, MaxExploEvents = 512};
+
 struct Action // @TODO: rename to PlayerAction?
 {
     int up = false;
@@ -401,39 +404,156 @@ struct Action // @TODO: rename to PlayerAction?
     int drop = false;
 };
 
+// bot pathfinding queue, the edge weights are small integers (Dial's algorithm)
+// pops the smallest key, ties are broken by the smaller value (the same order as
+// std::priority_queue<std::pair<int, int>> with std::greater); no allocations after init()
+struct BucketQueue
+{
+    // numBuckets must be a power of two greater than the largest edge weight
+    void init(int numBuckets, int maxItems);
+    void clear();
+    // pushed keys must be in [last popped key, last popped key + numBuckets)
+    // returns false if the key is out of range or there is no space left
+    bool push(int key, int value);
+    // returns false if the queue is empty
+    bool pop(int& key, int& value);
+
+    Array<int> heads; // -1 if the bucket is empty
+    Array<int> keys;
+    Array<int> values;
+    Array<int> nexts; // the next item in the bucket or in the free list
+    int freeHead;
+    int numUsed; // items [numUsed, keys.size()) were not used since clear()
+    int size;
+    int minKey;
+};
+
+// reused by every bot rescan, sized in Simulation::setMapSize()
+struct PathScratch
+{
+    BucketQueue queue;
+    Array<int> dist; // per tile index (y * width + x)
+    Array<int> prev;
+};
+
+// the bots view of the map, shared by all the bots; see Simulation::getDangerMap()
+struct DangerMap
+{
+    // tiles_ with the free tiles in the blast range of a bomb set to 3
+    TileGrid gameState;
+    // seconds until the tile is hit by an explosion (chain reactions included),
+    // FLT_MAX if no bomb reaches it
+    Grid<float> timeToDetonation;
+    int tick = -1; // Simulation::tick_ of the last update, -1 - must be updated
+};
+
 struct BotData
 {
     float timerDrop = 0.f;
     float timerDir = 0.f;
     int dir = Dir::Nil;
-    std::stack<int, std::vector<int>> shortestPath;
-    int gameState[13][13];
+    Array<int> shortestPath; // stack of tile indices, back() is the next tile; reserved
+    TileGrid gameState;
     ivec2 target;
 };
 
+// what is on a tile, kept in sync with Simulation::bombs_ and Simulation::players_
+struct TileOccupancy
+{
+    int bomb = -1; // index into bombs_, -1 if there is no bomb
+    int players = 0; // bitmask of players_ indices, a player is on the getPlayerTile() tile
+};
+
 struct Simulation
 {
     Simulation();
+    // the crates are placed with a new seed from rng_
     void setNewGame();
+    // the same crates for the same map size, number of players and mapSeed
+    void setNewGame(unsigned mapSeed);
     void processPlayerInput(const Action& action, const char* name);
+    int findPlayer(const char* name) const; // players_ index, -1 if there is no such player
     void updateAndProcessBotInput(const char* name, float dt);
     // returns true if setNewGame() was called
-    bool update(float dt, FixedArray<ExploEvent, 50>& exploEvents); // in seconds
-
-    enum {MapSize = 13, HP = 3};
+    // dt is clamped, use FixedStep for the deterministic tick boundaries
+    bool update(float dt, FixedArray<ExploEvent, MaxExploEvents>& exploEvents); // in seconds
+    // updated at most once per tick (and when a bomb is dropped)
+    const DangerMap& getDangerMap();
+    // must be called after bombs_ or players_ were modified from the outside (setNewGame()
+    // does it)
+    void rebuildOccupancy();
+    // resizes the map buffers and builds the walls, call setNewGame() after
+    void setMapSize(int width, int height);
+    bool isOnMap(ivec2 tile) const;
+
+    // the map edges and the pillars need odd dimensions
+    static bool isValidMapSize(int width, int height);
+
+    // LegacyMapSize is used by the clients that don't send the map dimensions
+    enum {LegacyMapSize = 13, MinMapSize = 5, MaxMapSize = 255, HP = 3};
     static const float dropCooldown_;
     static const float tileSize_;
     static const vec2 dirVecs_[Dir::Count];
     BotData botData_[MaxPlayers];
+    PathScratch pathScratch_;
+    DangerMap dangerMap_;
 
     // this must be serializable !!! server sends it as a readable text)
 
-    int tiles_[MapSize][MapSize] = {}; // initialized to 0
+    // 0 - free, 1 - crate, 2 - wall; LegacyMapSize x LegacyMapSize after the construction
+    TileGrid tiles_;
+    unsigned mapSeed_ = 0; // the crates of the current game
+    bool tilesFromSeed_ = false; // tiles_ have not changed since setNewGame(mapSeed_)
     FixedArray<Player, MaxPlayers> players_;
-    FixedArray<Bomb, 50> bombs_;
+    FixedArray<Bomb, MaxBombs> bombs_;
     float timeToStart_ = 0.f;
+    int tick_ = 0; // number of update() calls
+    Rng rng_; // mapSeed_ generator, seed it to get a reproducible sequence of games
+
+    // not serialized, see rebuildOccupancy()
+    Grid<TileOccupancy> occupancy_;
+    ivec2 playerTiles_[MaxPlayers]; // the player tiles registered in occupancy_
+    Array<int> freeTiles_; // setNewGame() scratch
+};
+
+// fixed timestep with an accumulator ('gaffer on games' technique)
+struct FixedStep
+{
+    // returns the number of Simulation::update(stepDt) calls to do for this frame
+    int advance(float frameDt);
+
+    float stepDt = 1.f / 120.f;
+    // if we fall behind more than this the rest of the accumulated time is dropped
+    int maxCatchUpSteps = 8;
+    float accumulator = 0.f;
+};
+
+// replay file (server --record, replayed by replay.cpp), little-endian integers
+// header: "CTRP", u8 ReplayVersion, f32 step dt
+// then the records, each one starts with u8 ReplayRecord:
+// - NewGame: u8 width, u8 height, u32 Simulation::rng_ seed, u8 number of players, then for
+//   each player (players_ order): u8 is bot, u8 name length, the name (no null)
+// - Input: u8 players_ index, u8 packAction()
+// - Step: u32 hashSimulation() after the update (the bots play before it)
+struct ReplayRecord
+{
+    enum
+    {
+        NewGame,
+        Input,
+        Step
+    };
 };
 
+enum {ReplayVersion = 1};
+
+// bit 0 up, 1 down, 2 left, 3 right, 4 drop
+int packAction(const Action& action);
+Action unpackAction(int bits);
+
+// FNV-1a of everything update() depends on and changes (not the bot state)
+unsigned hashSimulation(const Simulation& sim);
+
 namespace netcode
 {
 
@@ -451,16 +571,444 @@ struct Cmd
         SetName,
         NameOk,
         MustRename,
+        // binary since protocol 8, see encodePlayerInput(); text "up down left right drop seq",
+        // seq (since protocol 6) is acknowledged in Cmd::Simulation, see PendingInput
         PlayerInput,
         Simulation,
+        // binary, see encodeTileData() (the map seed or the tiles); protocol 0 clients get a
+        // digit + space per tile of the Simulation::LegacyMapSize map (row after row)
         InitTileData,
         AddBot,
         RemoveBot,
+        // payload is the protocol version as text, see ProtocolVersion
+        Protocol,
+        // payload is the tick of the last Snapshot received by the client (text)
+        SnapshotAck,
+        // room cmds have the room name as the payload
+        // the server responds to CreateRoom and JoinRoom with JoinRoom or RoomError
+        // CreateRoom can be followed by " width height" (server default if not)
+        CreateRoom,
+        JoinRoom,
+        ListRooms,
+        // "name numPlayers width height " for each room ("name numPlayers " for protocol 0)
+        RoomList,
+        // payload is the reason
+        RoomError,
+        // binary, see encodeExploEvents(); only to the UDP clients, their Cmd::Simulation has
+        // no events (it can be lost, the events must not be)
+        ExploEvents,
 
         _count
     };
 };
 
+// version 0 is the text protocol (every message is "CMD payload\0")
+// if the client and the server agree on ProtocolVersion (Cmd::Protocol handshake) the server
+// switches to the binary messages where they are available
+// 3 - the map dimensions in InitTileData, CreateRoom and RoomList
+// 4 - binary InitTileData
+// 5 - InitTileData carries the map seed, the clients generate the crates
+// 6 - PlayerInput sequence numbers (client-side prediction)
+// 7 - after the handshake the client sends every message binary, the text commands have their
+//     text payload (with the null char), see NetClient::addMsg()
+// 8 - binary PlayerInput with the redundant inputs
+enum {ProtocolVersion = 8};
+
+// binary message: [BinaryMsgMarker][u8 cmd][u16 payload size][payload]
+// (all the integers are little-endian); text messages never start with BinaryMsgMarker
+enum
+{
+    BinaryMsgMarker = 0xFF,
+    BinaryMsgHeaderSize = 4,
+    BinaryMsgMaxPayload = 0xFFFF
+};
+
+// a room hosts one match (Simulation), clients are assigned to a room on Cmd::SetName
+// room names have the same restrictions as the player names
+enum
+{
+    MaxRooms = 64,
+    RoomNameBufSize = 20
+};
+
+struct RoomInfo
+{
+    char name[RoomNameBufSize];
+    int numPlayers;
+    int mapWidth;
+    int mapHeight;
+};
+
+struct Msg
+{
+    int cmd; // 0 if unknown
+    const char* payload; // null terminated if !binary
+    int size; // payload size
+    bool binary;
+};
+
+// returns the number of bytes consumed, 0 if there is no complete message in the buffer
+int parseMsg(const char* buf, int size, Msg& msg);
+
+// the command name (getCmdStr()) lookup, hashed; returns 0 if there is no such command
+int findCmd(const char* name, int len);
+
+// appends little-endian values
+struct Writer
+{
+    explicit Writer(Array<char>& buf): buf(buf) {}
+    void u8(int v);
+    void u16(int v);
+    void u32(unsigned v);
+    void f32(float v);
+    void bytes(const void* data, int size);
+
+    Array<char>& buf;
+};
+
+// on out of bounds read error is set and zeroes are returned
+struct Reader
+{
+    Reader(const char* data, int size): it(data), end(data + size) {}
+    int u8();
+    int u16();
+    unsigned u32();
+    float f32();
+    void bytes(void* dst, int size);
+
+    const char* it;
+    const char* end;
+    bool error = false;
+};
+
+// Simulation state sent to the clients (binary protocol)
+struct Snapshot
+{
+    int tick = 0; // Simulation::tick_, 0 - not valid
+    float timeToStart;
+    FixedArray<Player, MaxPlayers> players;
+    FixedArray<Bomb, MaxBombs> bombs;
+};
+
+void takeSnapshot(Snapshot& snapshot, const Simulation& sim);
+void applySnapshot(Simulation& sim, const Snapshot& snapshot);
+
+// recent snapshots, used as the delta compression baselines
+// the last Size added snapshots; they are not added every tick (server --send-rate)
+struct SnapshotRing
+{
+    enum {Size = 32};
+
+    // returns nullptr if the snapshot was already overwritten (or never added)
+    const Snapshot* find(int tick) const;
+    // overwrites the oldest one
+    Snapshot& add(int tick);
+    void clear();
+
+    Snapshot snapshots[Size];
+    int next = 0;
+};
+
+// binary Cmd::Simulation payload
+// baseline is the last snapshot acknowledged by the client, nullptr means full snapshot;
+// inputSeq is the last Cmd::PlayerInput of the client processed by the simulation
+void encodeSimulation(Array<char>& buf, const Snapshot& snapshot, const Snapshot* baseline,
+                      const FixedArray<ExploEvent, MaxExploEvents>& exploEvents,
+                      unsigned inputSeq);
+
+// returns the decoded snapshot (added to the ring), nullptr if the payload is malformed or the
+// baseline is missing
+const Snapshot* decodeSimulation(const char* payload, int size, SnapshotRing& ring,
+                                 FixedArray<ExploEvent, MaxExploEvents>& exploEvents,
+                                 unsigned& inputSeq);
+
+// binary Cmd::InitTileData payload: u8 width, u8 height, u8 TileDataFormat, then
+// - Seed: u8 number of players, u32 Simulation::mapSeed_ (see Simulation::setNewGame(mapSeed))
+// - Tiles: TileGrid::rowBytes() bytes per row (4 tiles per byte)
+struct TileDataFormat
+{
+    enum
+    {
+        Seed,
+        Tiles
+    };
+};
+
+// the seed if sim.tilesFromSeed_
+void encodeTileData(Array<char>& buf, const Simulation& sim);
+
+// calls sim.setMapSize() if the dimensions have changed; the seed format also resets
+// sim.players_; returns false if the payload is malformed
+bool decodeTileData(const char* payload, int size, Simulation& sim);
+
+// binary Cmd::ExploEvents payload, the events part of Cmd::Simulation: u16 number of events,
+// then u8 x, u8 y, u8 ExploEvent::type per event
+void encodeExploEvents(Array<char>& buf,
+                       const FixedArray<ExploEvent, MaxExploEvents>& exploEvents);
+
+// appends to exploEvents; returns false if the payload is malformed
+bool decodeExploEvents(const char* payload, int size,
+                       FixedArray<ExploEvent, MaxExploEvents>& exploEvents);
+
+enum {InputRedundancy = 4}; // max number of inputs in Cmd::PlayerInput
+
+// binary Cmd::PlayerInput payload: u32 seq of the newest input, u8 number of inputs, then one
+// packAction() byte per input, the oldest first (consecutive seqs); the client repeats the
+// inputs that are not acknowledged yet so a lost message does not lose an input
+void encodePlayerInput(Array<char>& buf, unsigned seq, const Action* actions, int numActions);
+
+// returns false if the payload is malformed
+bool decodePlayerInput(const char* payload, int size, unsigned& seq,
+                       FixedArray<Action, InputRedundancy>& actions);
+
+// the received player states, the remote players are rendered between them (ticks are the
+// timeline, see NetClient::renderTick)
+struct InterpolationBuffer
+{
+    enum {Size = 64};
+
+    struct Entry
+    {
+        int tick;
+        FixedArray<Player, MaxPlayers> players;
+    };
+
+    // a tick older than the newest one restarts the buffer (new room), the same one is ignored
+    void add(int tick, const FixedArray<Player, MaxPlayers>& players);
+    void clear() {count = 0;}
+    const Entry& get(int i) const; // 0 is the oldest one, i < count
+
+    // the positions are interpolated between the entries around tick; after the newest entry
+    // they are extrapolated for at most maxExtrapolation ticks; a player that has moved by
+    // more than a tile (respawn) is not interpolated
+    // count must be > 0
+    void sample(float tick, float maxExtrapolation, FixedArray<Player, MaxPlayers>& players) const;
+
+    Entry entries[Size];
+    int newest = 0; // entries index
+    int count = 0;
+};
+
+// client-side prediction: the local inputs are applied to NetClient::predictionSim at once,
+// every snapshot rewinds it to NetClient::sim and replays the inputs the server has not
+// processed yet
+struct PendingInput
+{
+    unsigned seq;
+    Action action;
+    int numSteps; // predictionSim steps done after the input
+};
+
+// UDP transport (NetClient::udp), the server accepts it on the same port as TCP; the packets
+// carry the same framed messages (parseMsg()) as the TCP stream
+// packet: u32 UdpMagic, u32 connection id, u32 cookie, u16 seq, u16 ack (the newest seq
+// received), u32 ack bits (bit i - seq ack - i received), then the messages, each one preceded
+// by its channel:
+// - u8 UdpChannel::Unreliable: Cmd::Simulation, Cmd::PlayerInput and Cmd::SnapshotAck in the
+//   binary form; delivered at once, possibly out of order (a newer one supersedes a lost one)
+// - u8 UdpChannel::Reliable, u16 message id: everything else; resent until a packet carrying it
+//   is acknowledged, delivered in order
+// the client picks a random connection id, the server finds the connection by it (not by the
+// address, it can change on a mobile network)
+// a new connection: the server answers a packet of an unknown id that starts with the reliable
+// Cmd::Protocol message (id 0, see isUdpConnectPacket()) with a challenge sent to the packet
+// address: u32 UdpChallengeMagic, u32 connection id, u32 cookie (a keyed hash of the id); the
+// client puts the cookie in its packets from then on and only a connect packet with the right
+// cookie takes a slot, so the spoofed source addresses and the stale packets of a removed
+// connection can't
+// @TODO: the messages bigger than UdpMaxPacketSize rely on the IP fragmentation
+enum
+{
+    UdpMagic = 0x32555443, // "CTU2"
+    UdpChallengeMagic = 0x43555443, // "CTUC"
+    UdpHeaderSize = 20,
+    UdpChallengeSize = 12,
+    UdpMaxPacketSize = 1200, // the messages are packed up to this size
+    UdpMaxDatagram = 1 << 16
+};
+
+struct UdpChannel
+{
+    enum
+    {
+        Unreliable,
+        Reliable
+    };
+};
+
+// returns the connection id, 0 if the datagram is not a UdpLink packet
+unsigned getUdpConnectionId(const char* packet, int size);
+// the cookie of a UdpLink packet (0 until the client gets the challenge)
+unsigned getUdpPacketCookie(const char* packet, int size);
+// the header and every entry parse (no side effects, the server checks a packet before it
+// creates the connection of a new id)
+bool isValidUdpPacket(const char* packet, int size);
+// a valid packet that starts with the reliable Cmd::Protocol message with id 0, the first
+// message of a client; only such a packet can start a new connection on the server
+bool isUdpConnectPacket(const char* packet, int size);
+// the server response to a connect packet without the right cookie; returns the packet size
+int buildUdpChallenge(Array<char>& packet, unsigned id, unsigned cookie);
+
+// the reliability layer of one UDP connection (both ends), the time is in seconds
+struct UdpLink
+{
+    enum
+    {
+        NumSentPackets = 64, // the ack bits cover the last 32
+        MaxReliablePerPacket = 32,
+        ReliableWindow = 256 // the reliable messages in flight
+    };
+
+    struct Reliable
+    {
+        unsigned short id;
+        int offset; // reliableData
+        int size;
+        double sendTime; // < 0 - not sent yet
+        bool acked;
+    };
+
+    struct SentPacket
+    {
+        unsigned short seq;
+        bool acked = true;
+        double time;
+        FixedArray<unsigned short, MaxReliablePerPacket> reliableIds;
+    };
+
+    struct Received
+    {
+        unsigned short id;
+        int offset; // receivedData
+        int size;
+    };
+
+    // id must not be 0; clears everything; cookie - 0 on the client until the challenge
+    void reset(unsigned id, unsigned cookie);
+    // size bytes of complete messages (the sendBuf contents), they are split into the channels
+    void addMsgs(const char* data, int size);
+    // builds the next packet to send now (new messages, the reliable ones due to be resent, the
+    // acks); returns its size, 0 if there is nothing to send
+    int buildPacket(Array<char>& packet, double time);
+    // appends the messages to deliver to recvBuf (grown if needed); returns false if the packet
+    // is not for this connection, has a wrong cookie, is malformed (nothing is processed then),
+    // is a duplicate / too old or is a challenge (it sets the cookie)
+    bool receive(const char* packet, int size, double time, Array<char>& recvBuf,
+                 int& recvBufNumUsed);
+
+    unsigned id = 0;
+    unsigned cookie = 0; // in every packet, see UdpChallengeMagic
+    float rtt = 0.1f; // seconds, smoothed
+
+    // send
+    unsigned short seq = 0;
+    SentPacket sentPackets[NumSentPackets]; // seq % NumSentPackets
+    Array<Reliable> reliables; // not acknowledged, oldest first
+    Array<char> reliableData;
+    unsigned short nextReliableId = 0;
+    Array<char> unreliableData; // the unreliable messages not sent yet
+    int unreliableBegin = 0;
+
+    // receive
+    bool hasRemoteSeq = false;
+    unsigned short remoteSeq = 0; // the newest one
+    unsigned remoteAckBits = 0;
+    bool ackPending = false; // a packet with reliable messages has been received
+    unsigned short expectedReliableId = 0;
+    Array<Received> received; // the reliable messages after a missing one
+    Array<char> receivedData;
+
+    void processAck(unsigned short ackedSeq, double time);
+    void removeAcked();
+    void deliverReceived(Array<char>& recvBuf, int& recvBufNumUsed);
+};
+
+// network conditions for the loopback tests, see NetShim
+struct NetConditions
+{
+    bool isActive() const
+    {
+        return latency > 0.f || jitter > 0.f || bandwidth > 0 || loss > 0.f || reorder > 0.f;
+    }
+
+    float latency = 0.f; // seconds, one way
+    float jitter = 0.f; // seconds, a random [0, jitter] is added to the latency
+    int bandwidth = 0; // bytes per second, 0 - unlimited
+    float loss = 0.f; // [0, 1]
+    float reorder = 0.f; // [0, 1], the datagrams held back by NetShim::ReorderDelayMs
+    unsigned seed = 1;
+};
+
+// "latency=80,jitter=20,bandwidth=64,loss=2,reorder=1,seed=7" (ms, ms, kB/s, %, %), any
+// subset in any order; returns false if the string is malformed
+bool parseNetConditions(const char* str, NetConditions& conditions);
+
+// sits between the send buffers and the socket calls, the data is held back until it is due
+// (NetConditions) and written by send(); only the outgoing data, each end has its own shim
+// stream (TCP): nothing is lost or reordered, a lost chunk is delayed by StreamLossDelayMs (the
+// retransmission) and so are the chunks after it
+// datagrams (UDP): each one is lost or delayed on its own, a full link queue drops them
+struct NetShim
+{
+    enum
+    {
+        StreamLossDelayMs = 200,
+        ReorderDelayMs = 30,
+        MaxQueueDelayMs = 500 // bandwidth, the datagrams queued longer are dropped
+    };
+
+    struct Chunk
+    {
+        double time; // due
+        int offset; // bytes
+        int size;
+    };
+
+    // the rng is seeded with seed (the same conditions and seed give the same delays and losses)
+    void reset(const NetConditions& conditions, unsigned long long seed, bool datagram);
+    bool isActive() const {return conditions.isActive();}
+    bool empty() const {return chunks.empty();}
+    // size bytes of the stream or one datagram
+    void push(const char* data, int size, double time);
+    // writes the due data, sendto() if addr is not nullptr; a full socket buffer keeps the
+    // stream data and drops the datagrams; returns -1 on a socket error, the bytes sent
+    // otherwise
+    int send(int sockfd, double time, const sockaddr* addr = nullptr, socklen_t addrLen = 0);
+
+    NetConditions conditions;
+    bool datagram = false;
+    Rng rng;
+    Array<Chunk> chunks; // the push order
+    Array<char> bytes;
+    double linkFreeTime = 0.0; // bandwidth, the chunks before are on the wire until then
+    double lastDueTime = 0.0; // stream
+
+    float getRandom(); // [0, 1)
+    void removeChunk(int idx);
+};
+
+// the getaddrinfo() results of a host; it blocks, so they are reused by the reconnects
+struct HostAddrs
+{
+    enum {MaxAddrs = 4};
+
+    struct Addr
+    {
+        int family;
+        int socktype;
+        int protocol;
+        sockaddr_storage addr;
+        socklen_t addrLen;
+    };
+
+    char host[128] = {}; // NetClient::host
+    bool udp = false;
+    FixedArray<Addr, MaxAddrs> addrs; // empty - not resolved
+};
+
+// returns false on failure (hostAddrs.addrs is empty then)
+bool resolveHost(Array<char>& logBuf, const char* host, bool udp, HostAddrs& hostAddrs);
+
 // why Net and not just Client? to avoid name collision in server.cpp if we use
 // 'using namespace netcode;'; yes I know...
 
@@ -475,19 +1023,58 @@ struct NetClient
 
     // dt is seconds
     void update(float dt, const char* name,
-                FixedArray<ExploEvent, 50>& eevents, Action& playerAction);
+                FixedArray<ExploEvent, MaxExploEvents>& eevents, Action& playerAction);
+    // use this to e.g. send a chat message; binary once the server has agreed to
+    // ProtocolVersion, text before that (and with the older servers)
+    void addMsg(int cmd, const char* payload = "");
+    // displaySim if the server acknowledges the inputs (binary protocol), sim otherwise
+    const Simulation& getDisplaySim() const;
+    void rewindPrediction(unsigned ackedInputSeq);
+    void updateDisplaySim(float dt);
+    // Cmd::Ping in the next update() if there is none in flight, the Cmd::Pong sets rtt (the
+    // keep-alive ping is one of them)
+    void ping();
 
     const float timerAliveMax = 5.f;
     const float timerReconnectMax = 5.f;
     float timerReconnect = timerReconnectMax;
     float timerSendSetNameMsg = timerReconnectMax;
-    Array<char> sendBuf, recvBuf, logBuf;
+    RingBuffer sendBuf;
+    Array<char> recvBuf, logBuf;
     int recvBufNumUsed = 0;
     int sockfd = -1;
+    bool connecting = false; // sockfd waits for the TCP handshake, see finishConnect()
+    // the server has answered Cmd::Protocol; a finished TCP handshake alone can be the kernel
+    // accepting on a server that does not (the listen backlog)
+    bool connected = false;
     bool inGame = false;
     bool sendSetNameMsg = false;
+    int protocol = 0; // agreed with the server
+    SnapshotRing snapshots; // received from the server
+    int snapshotToAck = 0;
+    int newestSnapshotTick = 0; // applied, the older UDP ones are dropped
+    char roomName[RoomNameBufSize] = {}; // empty if the server has not assigned a room
+    FixedArray<RoomInfo, MaxRooms> rooms; // the last Cmd::RoomList
     Simulation sim;
     char inGameName[Player::NameBufSize]; // this will be used to identify the player in Simulation
+    Simulation predictionSim;
+    FixedStep predictionStep; // @ the server tick rate is assumed
+    FixedArray<PendingInput, 256> pendingInputs; // the oldest are dropped if full
+    unsigned inputSeq = 0; // of the last Cmd::PlayerInput
+    // a new input is sent when the action changes and at most once per predictionStep
+    // otherwise (the server drops the inputs before the round starts)
+    int inputBits = -1; // packAction() of the last input, -1 - none
+    float inputTimer = 0.f;
+    Array<char> inputPayload; // encodePlayerInput() scratch
+    FixedArray<ExploEvent, MaxExploEvents> predictionEvents; // not used, the server ones are
+
+    // predictionSim with the remote players from interpolation (they are
+    // interpolationDelay seconds in the past); only for the rendering, it is not updated
+    Simulation displaySim;
+    InterpolationBuffer interpolation;
+    float renderTick = 0.f; // of the remote players, follows the newest tick - delay
+    float interpolationDelay = 0.1f; // seconds, can be set externally
+    float maxExtrapolation = 0.05f; // seconds, can be set externally
 
     // initialized in connect() (see cpp file)
     bool serverAlive;
@@ -496,11 +1083,39 @@ struct NetClient
     // can be set externally
     char host[128] = "localhost";
     bool hasToReconnect = true; // due to tcp error or no server response;
+    bool udp = false; // the transport of the next connection, see UdpLink
+    NetConditions netConditions; // of the next connection, see NetShim
+    // resolved by the first connect, or set with resolveHost() (the load generator resolves
+    // the host once for all the clients)
+    HostAddrs hostAddrs;
+
+    UdpLink link; // if udp
+    NetShim shim; // if netConditions.isActive()
+    double netTime = 0.0; // UdpLink / NetShim time, the sum of the update() dts
+    Array<char> netScratch; // the sendBuf copy, UdpLink::buildPacket() / recv()
+
+    // statistics of all the connections (see loadgen.cpp)
+    long long numBytesSent = 0; // to the socket (to the shim if active)
+    long long numBytesReceived = 0;
+    int numSnapshots = 0; // applied Cmd::Simulation messages
+    int numConnects = 0; // see connected
+    int numConnectFailures = 0; // including the connections lost before they were connected
+    int numDisconnects = 0; // socket errors and the PONG timeouts of the connected ones
+    float rtt = -1.f; // seconds, of the last ping(), -1 - none yet; update() dt granularity
+    bool pingRequested = false;
+    double pingTime = -1.0; // netTime of the Cmd::Ping in flight, -1 - none
 
 };
 
-// use this to e.g. send a chat message
 void addMsg(Array<char>& sendBuf, int cmd, const char* payload = "");
+void addBinaryMsg(Array<char>& sendBuf, int cmd, const char* payload, int size);
+// Buffer - anything with write(const void* data, int size): RingBuffer, SendQueue (server)
+template<typename Buffer>
+void addMsg(Buffer& sendBuf, int cmd, const char* payload = "");
+template<typename Buffer>
+void addBinaryMsg(Buffer& sendBuf, int cmd, const char* payload, int size);
+// writev() of the whole sendBuf, the bytes sent are consumed; returns the writev() result
+int sendBuffer(int sockfd, RingBuffer& sendBuf);
 
 const char* getCmdStr(int cmd);
 const void* get_in_addr(const sockaddr* const sa);
@@ -518,8 +1133,9 @@ public:
 
 private:
     GLBuffers glBuffers_;
-    Rect rects_[Simulation::MapSize * Simulation::MapSize];
-    FixedArray<Explosion, 50> explosions_;
+    Rect rects_[MaxExploEvents]; // bombs, explosions, text
+    Array<Rect> tileRects_; // one per tile
+    FixedArray<Explosion, MaxExploEvents> explosions_;
     Emitter emitter_;
     Font font_;
     bool showScore_ = false;
@@ -545,10 +1161,14 @@ private:
     char nameToSetBuf_[Player::NameBufSize] = "player1";
     char inputNameBuf_[Player::NameBufSize] = {}; // flush to nameToSetBuf_ on ENTER
     char chatBuf_[128] = {};
+    char roomNameBuf_[netcode::RoomNameBufSize] = {};
+    // for the offline game and the created rooms
+    int mapSize_[2] = {Simulation::LegacyMapSize, Simulation::LegacyMapSize};
     Simulation offlineSim_;
+    FixedStep offlineStep_;
     PlayerView playerViews_[MaxPlayers];
     Action actions_[2];
-    FixedArray<ExploEvent, 50> exploEvents_;
+    FixedArray<ExploEvent, MaxExploEvents> exploEvents_;
     char hostnameBuf_[128] = {};
 
     struct InputType
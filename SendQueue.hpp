@@ -0,0 +1,273 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <sys/uio.h>
+#include "Array.hpp"
+
+// immutable encoded messages shared by the send queues of several connections (broadcasts); it
+// is built once and queued by reference, the last release() frees it; the reference count is
+// atomic, the blocks built by the workers are released by the network thread
+class MsgBlock
+{
+public:
+    // the reference count is 1
+    static MsgBlock* create(const void* data, int size)
+    {
+        void* const ptr = malloc(sizeof(MsgBlock) + size);
+        assert(ptr);
+        MsgBlock* const block = new(ptr) MsgBlock;
+        block->size_ = size;
+        memcpy((char*)ptr + sizeof(MsgBlock), data, size);
+        return block;
+    }
+
+    void retain() {refCount_.fetch_add(1, std::memory_order_relaxed);}
+
+    void release()
+    {
+        if(refCount_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            this->~MsgBlock();
+            free(this);
+        }
+    }
+
+    const char* data() const {return (const char*)(this + 1);}
+    int         size() const {return size_;}
+
+private:
+    std::atomic<int> refCount_ {1};
+    int size_;
+
+    MsgBlock() = default;
+};
+
+// the bytes to send to one connection: private messages (copied in) and MsgBlocks (queued by
+// reference) in the order they were added; send() passes the whole queue to one writev()
+class SendQueue
+{
+public:
+    SendQueue() = default;
+    ~SendQueue() {clear();}
+    SendQueue(const SendQueue&) = delete;
+    SendQueue& operator=(const SendQueue&) = delete;
+
+    void reserve(int size) {bytes_.reserve(size);}
+
+    // private bytes, see addMsg()
+    void write(const void* data, int size)
+    {
+        bytes_.write(data, size);
+        addPrivate(size);
+    }
+
+    // for the writers that copy the private bytes in directly: the free space (at least size
+    // bytes), followed by commitWrite()
+    int getWriteSpans(int size, RingBuffer::Span* spans)
+    {
+        bytes_.reserve(bytes_.size() + size);
+        return bytes_.getWriteSpans(spans);
+    }
+
+    void commitWrite(int size)
+    {
+        bytes_.commitWrite(size);
+        addPrivate(size);
+    }
+
+    // the block is retained until it is sent
+    void push(MsgBlock* block)
+    {
+        if(!block->size())
+            return;
+
+        block->retain();
+        segments_.pushBack({block, block->size()});
+        size_ += block->size();
+    }
+
+    // returns the writev() result, the bytes sent are removed
+    int send(int sockfd)
+    {
+        RingBuffer::Span spans[2];
+        const int numSpans = bytes_.getReadSpans(spans);
+        iovec iov[MaxIov];
+        int numIov = 0;
+        int privateOffset = 0; // the private bytes of the previous segments
+
+        for(int i = head_; i < segments_.size() && numIov < MaxIov; ++i)
+        {
+            const Segment& segment = segments_[i];
+
+            if(segment.block)
+            {
+                const int offset = segment.block->size() - segment.size;
+                iov[numIov].iov_base = (void*)(segment.block->data() + offset);
+                iov[numIov].iov_len = segment.size;
+                ++numIov;
+            }
+            else
+            {
+                numIov = addPrivateIov(iov, numIov, spans, numSpans, privateOffset,
+                                       privateOffset + segment.size);
+                privateOffset += segment.size;
+            }
+        }
+
+        const int rc = writev(sockfd, iov, numIov);
+
+        if(rc > 0)
+            consume(rc);
+
+        return rc;
+    }
+
+    // appends the whole queue to buf and clears it (the UDP connections packetize the messages)
+    void moveTo(Array<char>& buf)
+    {
+        RingBuffer::Span spans[2];
+        const int numSpans = bytes_.getReadSpans(spans);
+        iovec iov[MaxIov];
+        int numIov = 0;
+        int privateOffset = 0;
+        int size = buf.size();
+        buf.resize(size + size_);
+
+        for(int i = head_; i < segments_.size(); ++i)
+        {
+            const Segment& segment = segments_[i];
+
+            if(segment.block)
+            {
+                const int offset = segment.block->size() - segment.size;
+                memcpy(buf.data() + size, segment.block->data() + offset, segment.size);
+                size += segment.size;
+                continue;
+            }
+
+            numIov = addPrivateIov(iov, 0, spans, numSpans, privateOffset,
+                                   privateOffset + segment.size);
+            privateOffset += segment.size;
+
+            for(int j = 0; j < numIov; ++j)
+            {
+                memcpy(buf.data() + size, iov[j].iov_base, iov[j].iov_len);
+                size += iov[j].iov_len;
+            }
+        }
+
+        assert(size == buf.size());
+        clear();
+    }
+
+    void clear()
+    {
+        for(int i = head_; i < segments_.size(); ++i)
+        {
+            if(segments_[i].block)
+                segments_[i].block->release();
+        }
+
+        segments_.clear();
+        head_ = 0;
+        bytes_.clear();
+        size_ = 0;
+    }
+
+    int  size()  const {return size_;}
+    bool empty() const {return size_ == 0;}
+
+private:
+    enum {MaxIov = 64};
+
+    struct Segment
+    {
+        MsgBlock* block; // nullptr - private bytes (in bytes_)
+        int size; // not sent yet
+    };
+
+    RingBuffer bytes_;
+    Array<Segment> segments_; // FIFO, the ones before head_ are sent
+    int head_ = 0;
+    int size_ = 0;
+
+    int numSegments() const {return segments_.size() - head_;}
+
+    void addPrivate(int size)
+    {
+        if(!size)
+            return;
+
+        if(numSegments() && !segments_.back().block)
+            segments_.back().size += size;
+        else
+            segments_.pushBack({nullptr, size});
+
+        size_ += size;
+    }
+
+    // the logical range [begin, end) of the private bytes, it can be split by the ring wrap
+    static int addPrivateIov(iovec* iov, int numIov, const RingBuffer::Span* spans, int numSpans,
+                             int begin, int end)
+    {
+        int spanBegin = 0;
+
+        for(int s = 0; s < numSpans && numIov < MaxIov; ++s)
+        {
+            const int spanEnd = spanBegin + spans[s].size;
+            const int from = begin > spanBegin ? begin : spanBegin;
+            const int to = end < spanEnd ? end : spanEnd;
+
+            if(from < to)
+            {
+                iov[numIov].iov_base = spans[s].data + (from - spanBegin);
+                iov[numIov].iov_len = to - from;
+                ++numIov;
+            }
+
+            spanBegin = spanEnd;
+        }
+
+        return numIov;
+    }
+
+    void consume(int numBytes)
+    {
+        size_ -= numBytes;
+
+        while(numBytes)
+        {
+            Segment& segment = segments_[head_];
+            const int n = numBytes < segment.size ? numBytes : segment.size;
+            segment.size -= n;
+            numBytes -= n;
+
+            if(!segment.block)
+                bytes_.consume(n);
+
+            if(!segment.size)
+            {
+                if(segment.block)
+                    segment.block->release();
+
+                ++head_;
+            }
+        }
+
+        // the sent segments are removed once they are the majority, O(1) amortized
+        if(head_ == segments_.size())
+        {
+            segments_.clear();
+            head_ = 0;
+        }
+        else if(head_ >= 32 && head_ * 2 >= segments_.size())
+        {
+            for(int i = head_; i < segments_.size(); ++i)
+                segments_[i - head_] = segments_[i];
+
+            segments_.resize(segments_.size() - head_);
+            head_ = 0;
+        }
+    }
+};
@@ -1,11 +1,10 @@
 #include "Scene.hpp"
 #include <netdb.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <stdio.h>
-#include <stack>
-#include <vector>
-#include <queue>
 #include <limits.h>
+#include <errno.h>
 
 // @ this souldn't be there but... (not intuitive)
 namespace netcode
@@ -27,6 +26,14 @@ const char* getCmdStr(int cmd)
         case Cmd::InitTileData: return "INIT_TILE_DATA";
         case Cmd::AddBot:       return "ADD_BOT";
         case Cmd::RemoveBot:    return "REMOVE_BOT";
+        case Cmd::Protocol:     return "PROTOCOL";
+        case Cmd::SnapshotAck:  return "SNAPSHOT_ACK";
+        case Cmd::CreateRoom:   return "CREATE_ROOM";
+        case Cmd::JoinRoom:     return "JOIN_ROOM";
+        case Cmd::ListRooms:    return "LIST_ROOMS";
+        case Cmd::RoomList:     return "ROOM_LIST";
+        case Cmd::RoomError:    return "ROOM_ERROR";
+        case Cmd::ExploEvents:  return "EXPLO_EVENTS";
     }
     assert(false);
 }
@@ -59,6 +66,1285 @@ void addMsg(Array<char>& buffer, int cmd, const char* payload)
     }
 }
 
+void addBinaryMsg(Array<char>& buffer, const int cmd, const char* const payload, const int size)
+{
+    assert(cmd > 0 && cmd < Cmd::_count);
+    assert(size <= BinaryMsgMaxPayload);
+
+    Writer writer(buffer);
+    writer.u8(BinaryMsgMarker);
+    writer.u8(cmd);
+    writer.u16(size);
+    writer.bytes(payload, size);
+}
+
+template<typename Buffer>
+void addMsg(Buffer& buffer, const int cmd, const char* const payload)
+{
+    if(cmd)
+    {
+        const char* const cmdStr = getCmdStr(cmd);
+        buffer.write(cmdStr, strlen(cmdStr));
+        buffer.write(" ", 1);
+    }
+
+    buffer.write(payload, strlen(payload) + 1);
+}
+
+template<typename Buffer>
+void addBinaryMsg(Buffer& buffer, const int cmd, const char* const payload, const int size)
+{
+    assert(cmd > 0 && cmd < Cmd::_count);
+    assert(size <= BinaryMsgMaxPayload);
+
+    const unsigned char header[BinaryMsgHeaderSize] = {BinaryMsgMarker, (unsigned char)cmd,
+        (unsigned char)(size & 0xff), (unsigned char)(size >> 8)};
+
+    buffer.write(header, sizeof(header));
+    buffer.write(payload, size);
+}
+
+int sendBuffer(const int sockfd, RingBuffer& buffer)
+{
+    RingBuffer::Span spans[2];
+    const int numSpans = buffer.getReadSpans(spans);
+    iovec iov[2];
+
+    for(int i = 0; i < numSpans; ++i)
+    {
+        iov[i].iov_base = spans[i].data;
+        iov[i].iov_len = spans[i].size;
+    }
+
+    const int rc = writev(sockfd, iov, numSpans);
+
+    if(rc > 0)
+        buffer.consume(rc);
+
+    return rc;
+}
+
+// open addressing, the command names are hashed once
+struct CmdTable
+{
+    enum {Size = 64}; // power of two, at least 2 * Cmd::_count
+
+    static unsigned hash(const char* const name, const int len)
+    {
+        unsigned h = 2166136261u; // FNV-1a
+
+        for(int i = 0; i < len; ++i)
+            h = (h ^ (unsigned char)name[i]) * 16777619u;
+
+        return h;
+    }
+
+    CmdTable()
+    {
+        static_assert(Size >= 2 * Cmd::_count, "CmdTable::Size is too small");
+        memset(cmds, 0, sizeof(cmds));
+
+        for(int cmd = 1; cmd < Cmd::_count; ++cmd)
+        {
+            const char* const name = getCmdStr(cmd);
+            unsigned idx = hash(name, strlen(name)) & (Size - 1);
+
+            while(cmds[idx])
+                idx = (idx + 1) & (Size - 1);
+
+            cmds[idx] = cmd;
+        }
+    }
+
+    unsigned char cmds[Size]; // 0 - empty slot
+};
+
+int findCmd(const char* const name, const int len)
+{
+    static const CmdTable table;
+
+    for(unsigned idx = CmdTable::hash(name, len) & (CmdTable::Size - 1); table.cmds[idx];
+        idx = (idx + 1) & (CmdTable::Size - 1))
+    {
+        const char* const cmdStr = getCmdStr(table.cmds[idx]);
+
+        if(strncmp(cmdStr, name, len) == 0 && cmdStr[len] == '\0')
+            return table.cmds[idx];
+    }
+
+    return 0;
+}
+
+int parseMsg(const char* const buf, const int size, Msg& msg)
+{
+    if(size == 0)
+        return 0;
+
+    if((unsigned char)buf[0] == BinaryMsgMarker)
+    {
+        if(size < BinaryMsgHeaderSize)
+            return 0;
+
+        Reader reader(buf + 1, BinaryMsgHeaderSize - 1);
+        msg.cmd = reader.u8();
+        msg.size = reader.u16();
+
+        if(size < BinaryMsgHeaderSize + msg.size)
+            return 0;
+
+        if(msg.cmd >= Cmd::_count)
+            msg.cmd = 0;
+
+        msg.payload = buf + BinaryMsgHeaderSize;
+        msg.binary = true;
+        return BinaryMsgHeaderSize + msg.size;
+    }
+
+    const char* const end = (const char*)memchr((const void*)buf, '\0', size);
+
+    if(end == nullptr)
+        return 0;
+
+    const char* const space = (const char*)memchr((const void*)buf, ' ', end - buf);
+    const char* const nameEnd = space ? space : end;
+
+    msg.cmd = findCmd(buf, nameEnd - buf);
+    msg.payload = msg.cmd ? (space ? space + 1 : end) : buf;
+    msg.binary = false;
+    msg.size = end - msg.payload;
+    return end - buf + 1;
+}
+
+void Writer::u8(const int v)
+{
+    assert(v >= 0 && v <= 0xFF);
+    buf.pushBack(char(v));
+}
+
+void Writer::u16(const int v)
+{
+    assert(v >= 0 && v <= 0xFFFF);
+    buf.pushBack(char(v & 0xFF));
+    buf.pushBack(char(v >> 8));
+}
+
+void Writer::u32(const unsigned v)
+{
+    for(int i = 0; i < 4; ++i)
+        buf.pushBack(char( (v >> (i * 8)) & 0xFF ));
+}
+
+void Writer::f32(const float v)
+{
+    static_assert(sizeof(float) == sizeof(unsigned), "");
+    unsigned u;
+    memcpy(&u, &v, sizeof(u));
+    u32(u);
+}
+
+void Writer::bytes(const void* const data, const int size)
+{
+    const int prevSize = buf.size();
+    buf.resize(prevSize + size);
+    memcpy(buf.data() + prevSize, data, size);
+}
+
+int Reader::u8()
+{
+    if(end - it < 1)
+    {
+        error = true;
+        return 0;
+    }
+
+    return (unsigned char)*it++;
+}
+
+int Reader::u16()
+{
+    const int lo = u8();
+    return lo | (u8() << 8);
+}
+
+unsigned Reader::u32()
+{
+    unsigned v = 0;
+
+    for(int i = 0; i < 4; ++i)
+        v |= unsigned(u8()) << (i * 8);
+
+    return v;
+}
+
+float Reader::f32()
+{
+    const unsigned u = u32();
+    float v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+void Reader::bytes(void* const dst, const int size)
+{
+    if(end - it < size)
+    {
+        error = true;
+        memset(dst, 0, size);
+        it = end;
+        return;
+    }
+
+    memcpy(dst, it, size);
+    it += size;
+}
+
+void takeSnapshot(Snapshot& snapshot, const Simulation& sim)
+{
+    snapshot.timeToStart = sim.timeToStart_;
+    snapshot.players = sim.players_;
+    snapshot.bombs = sim.bombs_;
+}
+
+void applySnapshot(Simulation& sim, const Snapshot& snapshot)
+{
+    sim.timeToStart_ = snapshot.timeToStart;
+    sim.players_ = snapshot.players;
+    sim.bombs_ = snapshot.bombs;
+    sim.rebuildOccupancy();
+}
+
+void encodeTileData(Array<char>& buf, const Simulation& sim)
+{
+    const TileGrid& tiles = sim.tiles_;
+    Writer w(buf);
+    w.u8(tiles.width());
+    w.u8(tiles.height());
+
+    if(sim.tilesFromSeed_)
+    {
+        w.u8(TileDataFormat::Seed);
+        w.u8(sim.players_.size());
+        w.u32(sim.mapSeed_);
+        return;
+    }
+
+    w.u8(TileDataFormat::Tiles);
+    const int prevSize = buf.size();
+    buf.resize(prevSize + tiles.rowBytes() * tiles.height());
+    unsigned char* it = (unsigned char*)buf.data() + prevSize;
+
+    for(int y = 0; y < tiles.height(); ++y)
+    {
+        tiles.getRowBytes(y, it);
+        it += tiles.rowBytes();
+    }
+}
+
+bool decodeTileData(const char* const payload, const int size, Simulation& sim)
+{
+    Reader r(payload, size);
+    const int width = r.u8();
+    const int height = r.u8();
+    const int format = r.u8();
+
+    if(r.error || !Simulation::isValidMapSize(width, height))
+        return false;
+
+    TileGrid& tiles = sim.tiles_;
+
+    if(format == TileDataFormat::Seed)
+    {
+        const int numPlayers = r.u8();
+        const unsigned mapSeed = r.u32();
+
+        if(r.error || r.it != r.end || numPlayers > MaxPlayers)
+            return false;
+
+        if(tiles.width() != width || tiles.height() != height)
+            sim.setMapSize(width, height);
+
+        sim.players_.resize(numPlayers);
+        sim.setNewGame(mapSeed);
+        return true;
+    }
+
+    const int rowBytes = (width + 3) / 4;
+
+    if(format != TileDataFormat::Tiles || r.end - r.it != rowBytes * height)
+        return false;
+
+    if(tiles.width() != width || tiles.height() != height)
+        sim.setMapSize(width, height);
+
+    sim.tilesFromSeed_ = false;
+
+    for(int y = 0; y < height; ++y)
+    {
+        tiles.setRowBytes(y, (const unsigned char*)r.it);
+        r.it += rowBytes;
+
+        // 3 is not a tile value
+        for(int w = 0; w < tiles.wordsPerRow(); ++w)
+        {
+            if(tiles.find(y, w, 3))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+const Snapshot* SnapshotRing::find(const int tick) const
+{
+    if(tick <= 0)
+        return nullptr;
+
+    for(const Snapshot& snapshot: snapshots)
+    {
+        if(snapshot.tick == tick)
+            return &snapshot;
+    }
+
+    return nullptr;
+}
+
+Snapshot& SnapshotRing::add(const int tick)
+{
+    assert(tick > 0);
+    Snapshot& snapshot = snapshots[next];
+    next = (next + 1) % Size;
+    snapshot.tick = tick;
+    return snapshot;
+}
+
+void SnapshotRing::clear()
+{
+    for(Snapshot& snapshot: snapshots)
+        snapshot.tick = 0;
+
+    next = 0;
+}
+
+// delta compression is done per field; only these timers matter to the clients when they are
+// positive, so once they drop below 0 they are not sent anymore
+static bool timerChanged(const float current, const float baseline)
+{
+    return current != baseline && (current > 0.f || baseline > 0.f);
+}
+
+struct PlayerField
+{
+    enum
+    {
+        PosX = 1 << 0,
+        PosY = 1 << 1,
+        Vel = 1 << 2,
+        Dir = 1 << 3,
+        DropCooldown = 1 << 4,
+        Hp = 1 << 5,
+        Score = 1 << 6,
+        Name = 1 << 7,
+        DmgTimer = 1 << 8,
+        PrevDir = 1 << 9
+    };
+};
+
+struct SnapshotField
+{
+    enum
+    {
+        TimeToStart = 1 << 0,
+        Bombs = 1 << 1
+    };
+};
+
+static int getPlayerFieldMask(const Player& p, const Player& b)
+{
+    int mask = 0;
+    if(p.pos.x != b.pos.x)                   mask |= PlayerField::PosX;
+    if(p.pos.y != b.pos.y)                   mask |= PlayerField::PosY;
+    if(p.vel != b.vel)                       mask |= PlayerField::Vel;
+    if(p.dir != b.dir)                       mask |= PlayerField::Dir;
+    if(p.dropCooldown != b.dropCooldown)     mask |= PlayerField::DropCooldown;
+    if(p.hp != b.hp)                         mask |= PlayerField::Hp;
+    if(p.score != b.score)                   mask |= PlayerField::Score;
+    if(strcmp(p.name, b.name) != 0)          mask |= PlayerField::Name;
+    if(timerChanged(p.dmgTimer, b.dmgTimer)) mask |= PlayerField::DmgTimer;
+    if(p.prevDir != b.prevDir)               mask |= PlayerField::PrevDir;
+    return mask;
+}
+
+static bool bombsEqual(const FixedArray<Bomb, MaxBombs>& a, const FixedArray<Bomb, MaxBombs>& b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), sizeof(Bomb) * a.size()) == 0;
+}
+
+static void writeExploEvents(Writer& w,
+                             const FixedArray<ExploEvent, MaxExploEvents>& exploEvents)
+{
+    w.u16(exploEvents.size());
+
+    for(const ExploEvent& e: exploEvents)
+    {
+        w.u8(e.tile.x);
+        w.u8(e.tile.y);
+        w.u8(e.type);
+    }
+}
+
+// protocol (binary Cmd::Simulation):
+// - u8 ProtocolVersion
+// - u32 tick
+// - u32 baseline tick (0 - delta against an empty snapshot)
+// - u32 the last input seq of the receiver (Cmd::PlayerInput)
+// - u8 SnapshotField mask
+// - [f32 time to start]
+// - u8 num players
+// - for each player: u16 PlayerField mask and the fields in the mask order:
+//   f32 pos.x, f32 pos.y, f32 vel, u8 dir, f32 drop cooldown, u8 hp, u16 score,
+//   u8 name length + name (not terminated), f32 dmg timer, u8 prev dir
+//   (players that are not in the baseline are compared against Player())
+// - [u16 num bombs]
+// - [for each bomb: u8 tile.x, u8 tile.y, u8 range, f32 timer, MaxPlayers * u8 (player idx + 1)]
+// - u16 num explo events
+// - for each explo event: u8 tile.x, u8 tile.y, u8 type
+
+void encodeSimulation(Array<char>& buf, const Snapshot& snapshot, const Snapshot* baseline,
+                      const FixedArray<ExploEvent, MaxExploEvents>& exploEvents,
+                      const unsigned inputSeq)
+{
+    static const Snapshot emptySnapshot = Snapshot();
+    const Snapshot& base = baseline ? *baseline : emptySnapshot;
+    const Player emptyPlayer = Player();
+
+    int mask = 0;
+
+    if(!baseline || timerChanged(snapshot.timeToStart, base.timeToStart))
+        mask |= SnapshotField::TimeToStart;
+
+    if(!bombsEqual(snapshot.bombs, base.bombs))
+        mask |= SnapshotField::Bombs;
+
+    Writer w(buf);
+    w.u8(ProtocolVersion);
+    w.u32(snapshot.tick);
+    w.u32(base.tick);
+    w.u32(inputSeq);
+    w.u8(mask);
+
+    if(mask & SnapshotField::TimeToStart)
+        w.f32(snapshot.timeToStart);
+
+    w.u8(snapshot.players.size());
+
+    for(int i = 0; i < snapshot.players.size(); ++i)
+    {
+        const Player& p = snapshot.players[i];
+        const Player& b = i < base.players.size() ? base.players[i] : emptyPlayer;
+        const int pmask = getPlayerFieldMask(p, b);
+
+        w.u16(pmask);
+
+        if(pmask & PlayerField::PosX)         w.f32(p.pos.x);
+        if(pmask & PlayerField::PosY)         w.f32(p.pos.y);
+        if(pmask & PlayerField::Vel)          w.f32(p.vel);
+        if(pmask & PlayerField::Dir)          w.u8(p.dir);
+        if(pmask & PlayerField::DropCooldown) w.f32(p.dropCooldown);
+        if(pmask & PlayerField::Hp)           w.u8(p.hp);
+        if(pmask & PlayerField::Score)        w.u16(p.score);
+
+        if(pmask & PlayerField::Name)
+        {
+            const int nameLen = strlen(p.name);
+            w.u8(nameLen);
+            w.bytes(p.name, nameLen);
+        }
+
+        if(pmask & PlayerField::DmgTimer)     w.f32(p.dmgTimer);
+        if(pmask & PlayerField::PrevDir)      w.u8(p.prevDir);
+    }
+
+    if(mask & SnapshotField::Bombs)
+    {
+        w.u16(snapshot.bombs.size());
+
+        for(const Bomb& b: snapshot.bombs)
+        {
+            w.u8(b.tile.x);
+            w.u8(b.tile.y);
+            w.u8(b.range);
+            w.f32(b.timer);
+
+            for(const int idx: b.playerIdxs)
+                w.u8(idx + 1);
+        }
+    }
+
+    writeExploEvents(w, exploEvents);
+}
+
+void encodeExploEvents(Array<char>& buf,
+                       const FixedArray<ExploEvent, MaxExploEvents>& exploEvents)
+{
+    Writer w(buf);
+    writeExploEvents(w, exploEvents);
+}
+
+// the map size is not known here, Simulation::isOnMap() is checked by the users
+static bool isValidTile(const ivec2 tile)
+{
+    return tile.x >= 0 && tile.x < Simulation::MaxMapSize &&
+           tile.y >= 0 && tile.y < Simulation::MaxMapSize;
+}
+
+// appends to exploEvents, returns false if they don't fit or are not valid
+static bool readExploEvents(Reader& r, FixedArray<ExploEvent, MaxExploEvents>& exploEvents)
+{
+    const int numExploEvents = r.u16();
+
+    if(exploEvents.size() + numExploEvents > exploEvents.maxSize())
+        return false;
+
+    for(int i = 0; i < numExploEvents; ++i)
+    {
+        ExploEvent e;
+        e.tile.x = r.u8();
+        e.tile.y = r.u8();
+        e.type = r.u8();
+
+        if(!isValidTile(e.tile))
+            return false;
+
+        exploEvents.pushBack(e);
+    }
+
+    return true;
+}
+
+bool decodeExploEvents(const char* const payload, const int size,
+                       FixedArray<ExploEvent, MaxExploEvents>& exploEvents)
+{
+    Reader r(payload, size);
+    return readExploEvents(r, exploEvents) && !r.error && r.it == r.end;
+}
+
+void encodePlayerInput(Array<char>& buf, const unsigned seq, const Action* const actions,
+                       const int numActions)
+{
+    assert(numActions > 0 && numActions <= InputRedundancy);
+    Writer w(buf);
+    w.u32(seq);
+    w.u8(numActions);
+
+    for(int i = 0; i < numActions; ++i)
+        w.u8(packAction(actions[i]));
+}
+
+bool decodePlayerInput(const char* const payload, const int size, unsigned& seq,
+                       FixedArray<Action, InputRedundancy>& actions)
+{
+    Reader r(payload, size);
+    seq = r.u32();
+    const int numActions = r.u8();
+
+    if(r.error || numActions == 0 || numActions > actions.maxSize())
+        return false;
+
+    actions.clear();
+
+    for(int i = 0; i < numActions; ++i)
+    {
+        const int bits = r.u8();
+
+        if(bits >> 5)
+            return false;
+
+        actions.pushBack(unpackAction(bits));
+    }
+
+    return !r.error && r.it == r.end;
+}
+
+const Snapshot* decodeSimulation(const char* const payload, const int size, SnapshotRing& ring,
+                                 FixedArray<ExploEvent, MaxExploEvents>& exploEvents,
+                                 unsigned& inputSeq)
+{
+    Reader r(payload, size);
+
+    if(r.u8() != ProtocolVersion)
+        return nullptr;
+
+    const int tick = r.u32();
+    const int baselineTick = r.u32();
+    const unsigned seq = r.u32();
+
+    if(tick <= 0)
+        return nullptr;
+
+    // decode into a temporary, the ring slot of tick might be the baseline itself
+    Snapshot s;
+
+    if(baselineTick)
+    {
+        const Snapshot* const baseline = ring.find(baselineTick);
+
+        if(!baseline)
+            return nullptr;
+
+        s = *baseline;
+    }
+    else
+        s = Snapshot();
+
+    const int mask = r.u8();
+
+    if(mask & SnapshotField::TimeToStart)
+        s.timeToStart = r.f32();
+
+    const int numPlayers = r.u8();
+
+    if(numPlayers > s.players.maxSize())
+        return nullptr;
+
+    for(int i = s.players.size(); i < numPlayers; ++i)
+        s.players[i] = Player();
+
+    s.players.resize(numPlayers);
+
+    for(Player& p: s.players)
+    {
+        const int pmask = r.u16();
+
+        if(pmask & PlayerField::PosX)         p.pos.x = r.f32();
+        if(pmask & PlayerField::PosY)         p.pos.y = r.f32();
+        if(pmask & PlayerField::Vel)          p.vel = r.f32();
+        if(pmask & PlayerField::Dir)          p.dir = r.u8();
+        if(pmask & PlayerField::DropCooldown) p.dropCooldown = r.f32();
+        if(pmask & PlayerField::Hp)           p.hp = r.u8();
+        if(pmask & PlayerField::Score)        p.score = r.u16();
+
+        if(pmask & PlayerField::Name)
+        {
+            const int nameLen = r.u8();
+
+            if(nameLen >= Player::NameBufSize)
+                return nullptr;
+
+            r.bytes(p.name, nameLen);
+            p.name[nameLen] = '\0';
+        }
+
+        if(pmask & PlayerField::DmgTimer)     p.dmgTimer = r.f32();
+        if(pmask & PlayerField::PrevDir)      p.prevDir = r.u8();
+
+        if(p.dir >= Dir::Count || p.prevDir >= Dir::Count)
+            return nullptr;
+    }
+
+    if(mask & SnapshotField::Bombs)
+    {
+        const int numBombs = r.u16();
+
+        if(numBombs > s.bombs.maxSize())
+            return nullptr;
+
+        s.bombs.resize(numBombs);
+
+        for(Bomb& b: s.bombs)
+        {
+            b.tile.x = r.u8();
+            b.tile.y = r.u8();
+            b.range = r.u8();
+            b.timer = r.f32();
+
+            for(int& idx: b.playerIdxs)
+                idx = r.u8() - 1;
+
+            if(!isValidTile(b.tile))
+                return nullptr;
+        }
+    }
+
+    if(!readExploEvents(r, exploEvents) || r.error || r.it != r.end)
+        return nullptr;
+
+    Snapshot& snapshot = ring.add(tick);
+    snapshot = s;
+    snapshot.tick = tick;
+    inputSeq = seq;
+    return &snapshot;
+}
+
+// the 16 bit sequence numbers and message ids wrap around
+static bool seqGreater(const unsigned short a, const unsigned short b)
+{
+    return short(a - b) > 0;
+}
+
+static bool isUnreliableMsg(const Msg& msg)
+{
+    return msg.binary && (msg.cmd == Cmd::Simulation || msg.cmd == Cmd::PlayerInput ||
+                          msg.cmd == Cmd::SnapshotAck);
+}
+
+static void appendBytes(Array<char>& buf, const char* const data, const int size)
+{
+    const int prevSize = buf.size();
+    buf.resize(prevSize + size);
+    memcpy(buf.data() + prevSize, data, size);
+}
+
+// buf.size() is the capacity, numUsed the bytes received (NetClient / server recvBuf)
+static void appendBytes(Array<char>& buf, int& numUsed, const char* const data, const int size)
+{
+    if(numUsed + size > buf.size())
+        buf.resize(max(buf.size() * 2, numUsed + size));
+
+    memcpy(buf.data() + numUsed, data, size);
+    numUsed += size;
+}
+
+unsigned getUdpConnectionId(const char* const packet, const int size)
+{
+    Reader r(packet, size);
+    const unsigned magic = r.u32();
+    const unsigned id = r.u32();
+    return size >= UdpHeaderSize && magic == UdpMagic ? id : 0;
+}
+
+unsigned getUdpPacketCookie(const char* const packet, const int size)
+{
+    Reader r(packet, size);
+    r.u32(); // magic
+    r.u32(); // id
+    const unsigned cookie = r.u32();
+    return r.error ? 0 : cookie;
+}
+
+bool isValidUdpPacket(const char* const packet, const int size)
+{
+    if(!getUdpConnectionId(packet, size))
+        return false;
+
+    Reader r(packet + UdpHeaderSize, size - UdpHeaderSize);
+
+    while(r.it < r.end)
+    {
+        const int channel = r.u8();
+
+        if(channel == UdpChannel::Reliable)
+            r.u16();
+
+        Msg msg;
+        const int numBytes = r.error ? 0 : parseMsg(r.it, r.end - r.it, msg);
+
+        if(!numBytes || channel > UdpChannel::Reliable)
+            return false;
+
+        r.it += numBytes;
+    }
+
+    return true;
+}
+
+bool isUdpConnectPacket(const char* const packet, const int size)
+{
+    if(!isValidUdpPacket(packet, size))
+        return false;
+
+    Reader r(packet + UdpHeaderSize, size - UdpHeaderSize);
+    const int channel = r.u8();
+    const unsigned short msgId = r.u16();
+    Msg msg;
+    const int numBytes = r.error ? 0 : parseMsg(r.it, r.end - r.it, msg);
+    return numBytes && channel == UdpChannel::Reliable && msgId == 0 && msg.cmd == Cmd::Protocol;
+}
+
+int buildUdpChallenge(Array<char>& packet, const unsigned id, const unsigned cookie)
+{
+    packet.clear();
+    Writer w(packet);
+    w.u32(UdpChallengeMagic);
+    w.u32(id);
+    w.u32(cookie);
+    return packet.size();
+}
+
+void UdpLink::reset(const unsigned id_, const unsigned cookie_)
+{
+    assert(id_);
+    id = id_;
+    cookie = cookie_;
+    rtt = 0.1f;
+
+    seq = 0;
+
+    for(SentPacket& packet: sentPackets)
+        packet.acked = true;
+
+    reliables.clear();
+    reliableData.clear();
+    nextReliableId = 0;
+    unreliableData.clear();
+    unreliableBegin = 0;
+
+    hasRemoteSeq = false;
+    remoteSeq = 0;
+    remoteAckBits = 0;
+    ackPending = false;
+    expectedReliableId = 0;
+    received.clear();
+    receivedData.clear();
+}
+
+void UdpLink::addMsgs(const char* const data, const int size)
+{
+    const char* it = data;
+    const char* const end = data + size;
+
+    while(it != end)
+    {
+        Msg msg;
+        const int numBytes = parseMsg(it, end - it, msg);
+        assert(numBytes); // the send buffers have only complete messages
+
+        if(!numBytes)
+            break;
+
+        if(isUnreliableMsg(msg))
+            appendBytes(unreliableData, it, numBytes);
+        else
+        {
+            reliables.pushBack({nextReliableId, reliableData.size(), numBytes, -1.0, false});
+            appendBytes(reliableData, it, numBytes);
+            ++nextReliableId;
+        }
+
+        it += numBytes;
+    }
+}
+
+int UdpLink::buildPacket(Array<char>& packet, const double time)
+{
+    packet.clear();
+    Writer w(packet);
+    w.u32(UdpMagic);
+    w.u32(id);
+    w.u32(cookie);
+    w.u16(seq);
+    w.u16(remoteSeq);
+    w.u32(remoteAckBits);
+
+    FixedArray<unsigned short, MaxReliablePerPacket> reliableIds;
+
+    // the reliable messages first, the new ones and the ones not acknowledged in time
+    const double resendDelay = min(1.0, max(0.02, 2.0 * rtt));
+
+    for(Reliable& msg: reliables)
+    {
+        // reliables[0] is the oldest one not acknowledged, the receiver has everything before
+        // it, so it can buffer every message in the window
+        if(reliableIds.size() == reliableIds.maxSize() ||
+           (unsigned short)(msg.id - reliables[0].id) >= ReliableWindow)
+        {
+            break;
+        }
+
+        if(msg.acked || (msg.sendTime >= 0.0 && time - msg.sendTime < resendDelay))
+            continue;
+
+        // a bigger message is sent alone
+        if(packet.size() > UdpHeaderSize && packet.size() + 3 + msg.size > UdpMaxPacketSize)
+            break;
+
+        w.u8(UdpChannel::Reliable);
+        w.u16(msg.id);
+        w.bytes(reliableData.data() + msg.offset, msg.size);
+        msg.sendTime = time;
+        reliableIds.pushBack(msg.id);
+    }
+
+    while(unreliableBegin < unreliableData.size())
+    {
+        Msg msg;
+        const char* const data = unreliableData.data() + unreliableBegin;
+        const int numBytes = parseMsg(data, unreliableData.size() - unreliableBegin, msg);
+
+        if(packet.size() > UdpHeaderSize && packet.size() + 1 + numBytes > UdpMaxPacketSize)
+            break;
+
+        w.u8(UdpChannel::Unreliable);
+        w.bytes(data, numBytes);
+        unreliableBegin += numBytes;
+    }
+
+    if(unreliableBegin == unreliableData.size())
+    {
+        unreliableData.clear();
+        unreliableBegin = 0;
+    }
+
+    // an empty packet only to acknowledge the reliable messages
+    if(packet.size() == UdpHeaderSize && !ackPending)
+        return 0;
+
+    ackPending = false;
+
+    SentPacket& sent = sentPackets[seq % NumSentPackets];
+    sent.seq = seq;
+    sent.acked = false;
+    sent.time = time;
+    sent.reliableIds = reliableIds;
+    ++seq;
+    return packet.size();
+}
+
+void UdpLink::processAck(const unsigned short ackedSeq, const double time)
+{
+    SentPacket& sent = sentPackets[ackedSeq % NumSentPackets];
+
+    // overwritten, the messages will be resent
+    if(sent.acked || sent.seq != ackedSeq)
+        return;
+
+    sent.acked = true;
+    rtt += (float(time - sent.time) - rtt) * 0.1f;
+
+    // the ids are consecutive
+    for(const unsigned short msgId: sent.reliableIds)
+    {
+        if(reliables.empty())
+            break;
+
+        const int idx = (unsigned short)(msgId - reliables[0].id);
+
+        if(idx < reliables.size())
+            reliables[idx].acked = true;
+    }
+}
+
+void UdpLink::removeAcked()
+{
+    int numAcked = 0;
+
+    while(numAcked < reliables.size() && reliables[numAcked].acked)
+        ++numAcked;
+
+    if(!numAcked)
+        return;
+
+    const int offset = numAcked < reliables.size() ? reliables[numAcked].offset :
+                                                      reliableData.size();
+
+    reliableData.erase(0, offset);
+    reliables.erase(0, numAcked);
+
+    for(Reliable& msg: reliables)
+        msg.offset -= offset;
+}
+
+void UdpLink::deliverReceived(Array<char>& recvBuf, int& recvBufNumUsed)
+{
+    for(int i = 0; i < received.size();)
+    {
+        if(received[i].id != expectedReliableId)
+        {
+            ++i;
+            continue;
+        }
+
+        appendBytes(recvBuf, recvBufNumUsed, receivedData.data() + received[i].offset,
+                    received[i].size);
+
+        ++expectedReliableId;
+        received.erase(i);
+        i = 0;
+    }
+
+    if(received.empty())
+        receivedData.clear();
+}
+
+bool UdpLink::receive(const char* const packet, const int size, const double time,
+                      Array<char>& recvBuf, int& recvBufNumUsed)
+{
+    Reader r(packet, size);
+    const unsigned magic = r.u32();
+    const unsigned packetId = r.u32();
+    const unsigned packetCookie = r.u32();
+
+    // the client is not connected until its packets carry the cookie, the messages not
+    // acknowledged yet (Cmd::Protocol) are resent with it at once; the first cookie stays
+    if(magic == UdpChallengeMagic && size == UdpChallengeSize && !r.error && packetId == id &&
+       packetCookie && !cookie)
+    {
+        cookie = packetCookie;
+
+        for(Reliable& msg: reliables)
+            msg.sendTime = -1.0;
+
+        return false;
+    }
+
+    const unsigned short packetSeq = r.u16();
+    const unsigned short ack = r.u16();
+    const unsigned ackBits = r.u32();
+
+    if(r.error || magic != UdpMagic || packetId != id || packetCookie != cookie ||
+       !isValidUdpPacket(packet, size))
+    {
+        return false;
+    }
+
+    // the duplicates and the packets older than the ack bits are dropped (not acknowledged, the
+    // reliable messages will be resent)
+    if(!hasRemoteSeq)
+    {
+        hasRemoteSeq = true;
+        remoteSeq = packetSeq;
+        remoteAckBits = 1;
+    }
+    else if(seqGreater(packetSeq, remoteSeq))
+    {
+        const int shift = (unsigned short)(packetSeq - remoteSeq);
+        remoteAckBits = shift < 32 ? (remoteAckBits << shift) | 1 : 1;
+        remoteSeq = packetSeq;
+    }
+    else
+    {
+        const int age = (unsigned short)(remoteSeq - packetSeq);
+
+        if(age >= 32 || (remoteAckBits >> age) & 1)
+            return false;
+
+        remoteAckBits |= 1u << age;
+    }
+
+    for(int i = 0; i < 32; ++i)
+    {
+        if((ackBits >> i) & 1)
+            processAck(ack - i, time);
+    }
+
+    removeAcked();
+
+    while(r.it < r.end)
+    {
+        const int channel = r.u8();
+        const unsigned short msgId = channel == UdpChannel::Reliable ? r.u16() : 0;
+        Msg msg;
+        const int numBytes = r.error ? 0 : parseMsg(r.it, r.end - r.it, msg);
+        assert(numBytes && channel <= UdpChannel::Reliable); // see isValidUdpPacket()
+
+        if(channel == UdpChannel::Unreliable)
+            appendBytes(recvBuf, recvBufNumUsed, r.it, numBytes);
+        else
+        {
+            ackPending = true;
+            const int ahead = (unsigned short)(msgId - expectedReliableId);
+
+            if(ahead == 0)
+            {
+                appendBytes(recvBuf, recvBufNumUsed, r.it, numBytes);
+                ++expectedReliableId;
+                deliverReceived(recvBuf, recvBufNumUsed);
+            }
+            // the ones behind are duplicates
+            else if(ahead < ReliableWindow)
+            {
+                bool isNew = true;
+
+                for(const Received& other: received)
+                    isNew = isNew && other.id != msgId;
+
+                if(isNew)
+                {
+                    received.pushBack({msgId, receivedData.size(), numBytes});
+                    appendBytes(receivedData, r.it, numBytes);
+                }
+            }
+        }
+
+        r.it += numBytes;
+    }
+
+    return true;
+}
+
+bool parseNetConditions(const char* str, NetConditions& conditions)
+{
+    while(*str)
+    {
+        char key[16];
+        double value;
+        int numChars;
+
+        if(sscanf(str, "%15[a-z]=%lf%n", key, &value, &numChars) != 2 || value < 0.0)
+            return false;
+
+        str += numChars;
+
+        if(strcmp(key, "latency") == 0)
+            conditions.latency = value / 1000.0;
+
+        else if(strcmp(key, "jitter") == 0)
+            conditions.jitter = value / 1000.0;
+
+        else if(strcmp(key, "bandwidth") == 0)
+            conditions.bandwidth = int(value * 1000.0);
+
+        else if(strcmp(key, "loss") == 0)
+            conditions.loss = min(value, 100.0) / 100.0;
+
+        else if(strcmp(key, "reorder") == 0)
+            conditions.reorder = min(value, 100.0) / 100.0;
+
+        else if(strcmp(key, "seed") == 0)
+            conditions.seed = unsigned(value);
+
+        else
+            return false;
+
+        if(*str == ',')
+            ++str;
+        else if(*str)
+            return false;
+    }
+
+    return true;
+}
+
+void NetShim::reset(const NetConditions& conditions_, const unsigned long long seed,
+                    const bool datagram_)
+{
+    conditions = conditions_;
+    datagram = datagram_;
+    rng.setSeed(seed);
+    chunks.clear();
+    bytes.clear();
+    linkFreeTime = 0.0;
+    lastDueTime = 0.0;
+}
+
+float NetShim::getRandom()
+{
+    return rng.next() * (1.f / 4294967296.f);
+}
+
+void NetShim::push(const char* const data, const int size, const double time)
+{
+    double due = time;
+
+    if(conditions.bandwidth)
+    {
+        const double duration = double(size) / conditions.bandwidth;
+
+        if(datagram && linkFreeTime - time > MaxQueueDelayMs / 1000.0)
+            return;
+
+        linkFreeTime = max(linkFreeTime, time) + duration;
+        due = linkFreeTime;
+    }
+
+    due += conditions.latency + conditions.jitter * getRandom();
+    const bool lost = getRandom() < conditions.loss;
+
+    if(datagram)
+    {
+        if(lost)
+            return;
+
+        if(getRandom() < conditions.reorder)
+            due += ReorderDelayMs / 1000.0;
+    }
+    else
+    {
+        if(lost)
+            due += StreamLossDelayMs / 1000.0;
+
+        // in order, a late chunk holds back the next ones
+        due = max(due, lastDueTime);
+        lastDueTime = due;
+    }
+
+    chunks.pushBack({due, bytes.size(), size});
+    appendBytes(bytes, data, size);
+}
+
+void NetShim::removeChunk(const int idx)
+{
+    chunks.erase(idx);
+
+    if(chunks.empty())
+    {
+        bytes.clear();
+        return;
+    }
+
+    // the bytes before the oldest chunk are removed once they are the majority
+    const int offset = chunks[0].offset;
+
+    if(offset >= 4096 && offset * 2 >= bytes.size())
+    {
+        bytes.erase(0, offset);
+
+        for(Chunk& chunk: chunks)
+            chunk.offset -= offset;
+    }
+}
+
+int NetShim::send(const int sockfd, const double time, const sockaddr* const addr,
+                  const socklen_t addrLen)
+{
+    int numSent = 0;
+
+    while(chunks.size())
+    {
+        // the datagrams can be due out of order
+        int idx = 0;
+
+        for(int i = 1; datagram && i < chunks.size(); ++i)
+        {
+            if(chunks[i].time < chunks[idx].time)
+                idx = i;
+        }
+
+        Chunk& chunk = chunks[idx];
+
+        if(chunk.time > time)
+            break;
+
+        const char* const data = bytes.data() + chunk.offset;
+        const int rc = addr ? sendto(sockfd, data, chunk.size, 0, addr, addrLen) :
+                              ::send(sockfd, data, chunk.size, 0);
+
+        if(rc == -1)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+
+            // a full socket buffer is a datagram loss
+            if(!datagram)
+                break;
+        }
+        else
+        {
+            numSent += rc;
+
+            if(!datagram && rc < chunk.size)
+            {
+                chunk.offset += rc;
+                chunk.size -= rc;
+                break;
+            }
+        }
+
+        removeChunk(idx);
+    }
+
+    return numSent;
+}
+
 } // netcode
 
 // static data definitions
@@ -120,35 +1406,95 @@ bool isCollision(const vec2 playerPos, const ivec2 tile, const float tileSize)
            playerPos.y + tileSize > tilePos.y;
 }
 
+bool Simulation::isValidMapSize(const int width, const int height)
+{
+    return width >= MinMapSize && width <= MaxMapSize && width % 2 &&
+           height >= MinMapSize && height <= MaxMapSize && height % 2;
+}
+
 Simulation::Simulation()
 {
-    assert(MapSize % 2);
+    setMapSize(LegacyMapSize, LegacyMapSize);
+}
+
+void Simulation::setMapSize(const int width, const int height)
+{
+    assert(isValidMapSize(width, height));
+    const int numTiles = width * height;
+
+    tiles_.resize(width, height);
+    bombs_.clear();
+    occupancy_.resize(width, height);
+    freeTiles_.resize(numTiles);
+    dangerMap_.gameState.resize(width, height);
+    dangerMap_.timeToDetonation.resize(width, height);
+    dangerMap_.tick = -1;
+
+    // the bot buffers are allocated here, not on the tick path
+
+    for(BotData& botData: botData_)
+    {
+        botData.shortestPath.clear();
+        botData.shortestPath.reserve(numTiles);
+        botData.gameState.resize(width, height);
+    }
+
+    pathScratch_.dist.resize(numTiles);
+    pathScratch_.prev.resize(numTiles);
+
+    // the largest bot search edge weight is 7 + the manhattan distance heuristic;
+    // a tile is pushed at most once per edge (plus the source)
+    int numBuckets = 1;
+
+    while(numBuckets <= 7 + width + height)
+        numBuckets *= 2;
+
+    pathScratch_.queue.init(numBuckets, numTiles * 4 + 1);
 
     // tilemap edges
 
-    for(int i = 0; i < MapSize; ++i)
+    for(int x = 0; x < width; ++x)
     {
-        tiles_[0][i] = 2;
-        tiles_[MapSize - 1][i] = 2;
-        tiles_[i][0] = 2;
-        tiles_[i][MapSize - 1] = 2;
+        tiles_.set(x, 0, 2);
+        tiles_.set(x, height - 1, 2);
+    }
+
+    for(int y = 0; y < height; ++y)
+    {
+        tiles_.set(0, y, 2);
+        tiles_.set(width - 1, y, 2);
     }
 
     // tilemap pillars
 
-    for(int i = 2; i < MapSize - 1; i += 2)
+    for(int y = 2; y < height - 1; y += 2)
     {
-        for(int j = 2; j < MapSize - 1; j += 2)
+        for(int x = 2; x < width - 1; x += 2)
         {
-            tiles_[j][i] = 2;
+            tiles_.set(x, y, 2);
         }
     }
+
+    rebuildOccupancy();
+}
+
+bool Simulation::isOnMap(const ivec2 tile) const
+{
+    return tile.x >= 0 && tile.x < tiles_.width() && tile.y >= 0 && tile.y < tiles_.height();
 }
 
 void Simulation::setNewGame()
+{
+    setNewGame(rng_.next());
+}
+
+void Simulation::setNewGame(const unsigned mapSeed)
 {
     // @ set BotData to default state here if you want
+    const int width = tiles_.width();
+    const int height = tiles_.height();
     bombs_.clear();
+    dangerMap_.tick = -1;
 
     for(int i = 0; i < players_.maxSize(); ++i)
     {
@@ -167,17 +1513,17 @@ void Simulation::setNewGame()
                 break;
 
             case 1:
-                player.pos = vec2(tileSize_ * (MapSize - 2));
+                player.pos = vec2(tileSize_) * vec2(width - 2, height - 2);
                 player.prevDir = Dir::Left;
                 break;
 
             case 2:
-                player.pos = vec2(tileSize_) * vec2(1, MapSize - 2);
+                player.pos = vec2(tileSize_) * vec2(1, height - 2);
                 player.prevDir = Dir::Right;
                 break;
 
             case 3:
-                player.pos = vec2(tileSize_) * vec2(MapSize - 2, 1);
+                player.pos = vec2(tileSize_) * vec2(width - 2, 1);
                 player.prevDir = Dir::Down;
                 break;
 
@@ -188,72 +1534,85 @@ void Simulation::setNewGame()
 
     // tilemap crates
 
-    int freeTiles[MapSize * MapSize];
+    int* const freeTiles = freeTiles_.data();
     int numFreeTiles = 0;
 
     // delete crates from previous game
-    for(int i = 0; i < MapSize * MapSize; ++i)
-    {
-        if(tiles_[0][i] == 1)
-            tiles_[0][i] = 0;
-    }
+    tiles_.replace(1, 0);
 
-    for(int i = 0; i < MapSize * MapSize; ++i)
+    for(int y = 0; y < height; ++y)
     {
-        if(tiles_[0][i] == 0)
+        for(int w = 0; w < tiles_.wordsPerRow(); ++w)
         {
-            // check if it is not adjacent to the players
+            // the free tiles of the word, in the x order
+            for(TileGrid::Word mask = tiles_.find(y, w, 0); mask; mask &= mask - 1)
+            {
+                const int x = w * TileGrid::TilesPerWord + __builtin_ctzll(mask) / 2;
 
-            const ivec2 targetTile = {i % MapSize, i / MapSize};
+                // check if it is not adjacent to the players
 
-            for(const Player& player: players_)
-            {
-                for(int k = -1; k < 2; ++k)
+                const ivec2 targetTile = {x, y};
+
+                for(const Player& player: players_)
                 {
-                    for(int l = -1; l < 2; ++l)
+                    for(int k = -1; k < 2; ++k)
                     {
-                        const ivec2 adjacentTile = getPlayerTile(player, tileSize_)
-                                                   + ivec2(k, l);
+                        for(int l = -1; l < 2; ++l)
+                        {
+                            const ivec2 adjacentTile = getPlayerTile(player, tileSize_)
+                                                       + ivec2(k, l);
 
-                        if(targetTile == adjacentTile)
-                            goto end;
+                            if(targetTile == adjacentTile)
+                                goto end;
+                        }
                     }
                 }
+                freeTiles[numFreeTiles] = y * width + x;
+                ++numFreeTiles;
+end:;
             }
-            freeTiles[numFreeTiles] = i;
-            ++numFreeTiles;
         }
-end:;
     }
 
+    mapSeed_ = mapSeed;
+    tilesFromSeed_ = true;
+    Rng rng(mapSeed);
+
     const int numCrates = numFreeTiles * 2 / 3;
     for(int i = 0; i < numCrates; ++i)
     {
-        const int freeTileIdx = getRandomInt(0, numFreeTiles - 1);
+        const int freeTileIdx = rng.getInt(0, numFreeTiles - 1);
         const int tileIdx = freeTiles[freeTileIdx];
         freeTiles[freeTileIdx] = freeTiles[numFreeTiles - 1];
-        tiles_[0][tileIdx] = 1;
+        tiles_.set(tileIdx % width, tileIdx / width, 1);
         numFreeTiles -= 1;
     }
+
+    rebuildOccupancy();
 }
 
-// Change these values if you change MapSize... ugly
-ivec2 minDistance(int dist[][13], bool sptSet[][13], int MapSize) 
-{ 
-   // Initialize min value 
-    int min = INT_MAX;
-    ivec2 min_index; 
-    for (int i = 0; i < MapSize; ++i)
+void Simulation::rebuildOccupancy()
+{
+    occupancy_.fill(TileOccupancy());
+
+    // the state might come from the network, entries outside of the map are not indexed
+
+    for(int i = 0; i < bombs_.size(); ++i)
     {
-        for (int v = 0; v < MapSize; v++) 
-        {
-            if (sptSet[i][v] == false && dist[i][v] <= min) 
-                min = dist[i][v], 
-                min_index = {v, i}; 
-        }
+        const ivec2 tile = bombs_[i].tile;
+
+        if(isOnMap(tile))
+            occupancy_[tile.y][tile.x].bomb = i;
+    }
+
+    for(int i = 0; i < players_.size(); ++i)
+    {
+        const ivec2 tile = getPlayerTile(players_[i], tileSize_);
+        playerTiles_[i] = tile;
+
+        if(isOnMap(tile))
+            occupancy_[tile.y][tile.x].players |= 1 << i;
     }
-   
-    return min_index; 
 }
 
 void Simulation::updateAndProcessBotInput(const char* name, float dt)
@@ -281,6 +1640,7 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
 
     BotData& botData = botData_[pptr - players_.begin()];
     Action action;
+    const int width = tiles_.width(); // tile index = y * width + x
 
     botData.timerDrop += dt;
     botData.timerDir += dt;
@@ -292,71 +1652,51 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
         botData.timerDir = 0.f;
 
         // Getting state of the game, with danger zones...
-        int gameState[MapSize][MapSize];
-        memcpy(gameState, tiles_, sizeof(tiles_));
-        int dummyRange;
-
-        for(int bombIdx = 0; bombIdx < bombs_.size(); ++bombIdx)
-        {
-            Bomb bomb = bombs_[bombIdx];
-            dummyRange = bomb.range + 2;
-            gameState[bomb.tile.y][bomb.tile.x] = 3;
-
-            for(int dirIdx = Dir::Nil; dirIdx < Dir::Count; ++dirIdx)
-            {
-                const vec2 dir = dirVecs_[dirIdx];
-                const int range = (dirIdx != Dir::Nil) ? bomb.range : 1;
+        const DangerMap& dangerMap = getDangerMap();
+        const TileGrid& gameState = dangerMap.gameState;
 
-                for(int step = 1; step <= range; ++step)
-                {
-                    const ivec2 tile = bomb.tile + ivec2(dir) * step;
-                    int tileValue = tiles_[tile.y][tile.x];
-
-                    if (tileValue == 0) 
-                    {
-                        // Set tile to danger zone!
-                        gameState[tile.y][tile.x] = 3;
-                    }
-                }
-            }
-        }
         // Copy the state of the game to the memory of bot
-        memcpy(botData.gameState, gameState, sizeof(tiles_));
-        
-        // ******** STOP DANGER ZONE *********
+        botData.gameState.assign(gameState);
 
         // START CHECKING IF IT SAFE
         const ivec2 underPlayerTile = getPlayerTile(botPlayer, tileSize_);
-        if (gameState[underPlayerTile.y][underPlayerTile.x] == 3) 
+        if (gameState.get(underPlayerTile.x, underPlayerTile.y) == 3) 
         {   
             // Run for your life
 
-            std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<std::pair<int, int>>> Q;
-            std::vector<int> dist;
-            std::vector<int> prev;
-            int n = MapSize * MapSize;
-            prev.assign(n, -1);
-            dist.assign(n, INT_MAX);
+            // time to cross one tile
+            const float stepTime = tileSize_ / botPlayer.vel;
+
+            BucketQueue& Q = pathScratch_.queue;
+            int* const dist = pathScratch_.dist.data();
+            int* const prev = pathScratch_.prev.data();
+            Q.clear();
+
+            for(int i = 0; i < tiles_.size(); ++i)
+            {
+                prev[i] = -1;
+                dist[i] = INT_MAX;
+            }
 
-            int source = underPlayerTile.y * MapSize + underPlayerTile.x;
+            int source = underPlayerTile.y * width + underPlayerTile.x;
             dist[source] = 0;
-            Q.push({0, source});
+            Q.push(0, source);
 
             // Perform Dijkstra which returns shortes path tiles.
-            while (!Q.empty())
+            int key, curr;
+
+            while (Q.pop(key, curr))
             {
-                int curr = Q.top().second;
-                Q.pop();
 
-                int currX = curr % MapSize;
-                int currY = (curr - currX) / MapSize;
-                int currVal = gameState[currY][currX];
+                int currX = curr % width;
+                int currY = (curr - currX) / width;
+                int currVal = gameState.get(currX, currY);
                 
                 if (currVal == 0 || dist[curr] == 5) 
                 {
                     // add to the path and break - we have found our safe place
                     // or the path got too long.
-                    botData.shortestPath.push(curr); 
+                    botData.shortestPath.pushBack(curr); 
                     break;
                 }
 
@@ -365,21 +1705,29 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
                 {
                         const vec2 dir = dirVecs_[dirIdx];
                         int next;
-                        if (dirIdx == Dir::Up || dirIdx == Dir::Down) next = curr + MapSize * dir.y;
+                        if (dirIdx == Dir::Up || dirIdx == Dir::Down) next = curr + width * dir.y;
                         else next = curr + dir.x;
 
-                        int nextX = next % MapSize;
-                        int nextY = (next - nextX) / MapSize;
-                        const int nextTileVal = gameState[nextY][nextX];
+                        int nextX = next % width;
+                        int nextY = (next - nextX) / width;
+                        const int nextTileVal = gameState.get(nextX, nextY);
                         
                         if (nextTileVal == 0 || nextTileVal == 3) 
                         {
+                            // don't run into an explosion, skip the tiles that will be
+                            // hit while the bot is passing them
+                            const float arrival = dist[curr] * stepTime;
+                            const float detonation = dangerMap.timeToDetonation[nextY][nextX];
+
+                            if(detonation >= arrival && detonation <= arrival + stepTime)
+                                continue;
+
                             int alt = dist[curr] + 1;
                             if (alt < dist[next]) 
                             {
                                 dist[next] = alt;
                                 prev[next] = curr;
-                                Q.push({dist[next], next});
+                                Q.push(dist[next], next);
                             }
                         }
                 }    
@@ -388,13 +1736,13 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
               // Get the shortest path
             if (!botData.shortestPath.empty()) 
             {
-                int targetTile = botData.shortestPath.top();
+                int targetTile = botData.shortestPath.back();
                 int parentTile = prev[targetTile];
                 targetTile = parentTile;
                 
                 while (targetTile != -1)
                 {
-                    botData.shortestPath.push(targetTile);
+                    botData.shortestPath.pushBack(targetTile);
                     targetTile = prev[targetTile];
                 }
             }
@@ -402,18 +1750,22 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
         else
         {
             // Agressive mode
-            std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<std::pair<int, int>>> Q;
-            std::vector<int> dist;
-            std::vector<int> prev;
-            int n = MapSize * MapSize;
-            prev.assign(n, -1);
-            dist.assign(n, INT_MAX);
-
-            int source = underPlayerTile.y * MapSize + underPlayerTile.x;
+            BucketQueue& Q = pathScratch_.queue;
+            int* const dist = pathScratch_.dist.data();
+            int* const prev = pathScratch_.prev.data();
+            Q.clear();
+
+            for(int i = 0; i < tiles_.size(); ++i)
+            {
+                prev[i] = -1;
+                dist[i] = INT_MAX;
+            }
+
+            int source = underPlayerTile.y * width + underPlayerTile.x;
             dist[source] = 0;
             double minDistance = INT_MAX;
             ivec2 closestPlayerPos;
-            Q.push({0, source});
+            Q.push(0, source);
 
             // Finding the closest player to be the target...
             for (Player pl : players_)
@@ -430,22 +1782,22 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
 
             // Perform A* search algorithm to get to the closest player
             // Btw it's just dijikstra with some heuristic.
-            while (!Q.empty())
+            int key, curr;
+
+            while (Q.pop(key, curr))
             {
-                int curr = Q.top().second;
-                Q.pop();
 
-                int currX = curr % MapSize;
-                int currY = (curr - currX) / MapSize;
+                int currX = curr % width;
+                int currY = (curr - currX) / width;
                 ivec2 currTile = {currX, currY};
-                int currVal = gameState[currY][currX];
+                int currVal = gameState.get(currX, currY);
                 
                 //  && dist[curr] > 3
                 if (currTile == botData.target || (currVal == 1 && dist[curr] > 3)) 
                 {
                     // add to the path and break - we have our target
                     // or there is crate on the way...
-                    botData.shortestPath.push(curr); 
+                    botData.shortestPath.pushBack(curr); 
                     break;
                 }
 
@@ -454,12 +1806,12 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
                 {
                         const vec2 dir = dirVecs_[dirIdx];
                         int next;
-                        if (dirIdx == Dir::Up || dirIdx == Dir::Down) next = curr + MapSize * dir.y;
+                        if (dirIdx == Dir::Up || dirIdx == Dir::Down) next = curr + width * dir.y;
                         else next = curr + dir.x;
 
-                        int nextX = next % MapSize;
-                        int nextY = (next - nextX) / MapSize;
-                        const int nextTileVal = gameState[nextY][nextX];
+                        int nextX = next % width;
+                        int nextY = (next - nextX) / width;
+                        const int nextTileVal = gameState.get(nextX, nextY);
                         
                         // If next tile is "free" perform standard pathfinding with heurisitc
                         // 
@@ -470,7 +1822,7 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
                             {
                                 dist[next] = alt;
                                 prev[next] = curr;
-                                Q.push({dist[next], next});
+                                Q.push(dist[next], next);
                             }
                         } 
                         // If next tile is "dangerous" assign higher weight to it...
@@ -482,7 +1834,7 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
                             {
                                 dist[next] = alt;
                                 prev[next] = curr;
-                                Q.push({dist[next], next});
+                                Q.push(dist[next], next);
                             }
                         }
                 }    
@@ -490,7 +1842,7 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
 
             if (!botData.shortestPath.empty()) 
             {
-                int targetTile = botData.shortestPath.top();
+                int targetTile = botData.shortestPath.back();
                 if (targetTile != -1) 
                 {
                     int parentTile = prev[targetTile];
@@ -499,7 +1851,7 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
                 
                 while (targetTile != -1)
                 {
-                    botData.shortestPath.push(targetTile);
+                    botData.shortestPath.pushBack(targetTile);
                     targetTile = prev[targetTile];
                 }
             }
@@ -510,17 +1862,17 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
     if (botData.timerDir > 0.2f && !botData.shortestPath.empty())
     {
         botData.timerDir = 0.f;
-        int nextTile = botData.shortestPath.top();
+        int nextTile = botData.shortestPath.back();
 
-        botData.shortestPath.pop();
-        int nextTileX = nextTile % MapSize;
-        int nextTileY = (nextTile - nextTileX) / MapSize;
+        botData.shortestPath.popBack();
+        int nextTileX = nextTile % width;
+        int nextTileY = (nextTile - nextTileX) / width;
         ivec2 nextMove = {nextTileX, nextTileY};
 
         // If we have accesed player or crate, drop the bomb
         // TODO: check if nextTileX and Y don't get negative
         if ((nextMove == botData.target ||
-             botData.gameState[nextTileY][nextTileX] == 1) && botData.timerDrop > 3.f)
+             botData.gameState.get(nextTileX, nextTileY) == 1) && botData.timerDrop > 3.f)
         {
             action.drop = true;
             botData.timerDrop = 0.f;
@@ -545,7 +1897,7 @@ void Simulation::updateAndProcessBotInput(const char* name, float dt)
             {
                 const vec2 dir = dirVecs_[dirIdx];
                 const ivec2 tile = botPosition + ivec2(dir);
-                int tileValue = botData.gameState[tile.y][tile.x];
+                int tileValue = botData.gameState.get(tile.x, tile.y);
                 if (tileValue == 0 || tileValue == 3) 
                 {
                     botData.dir = dirIdx;
@@ -568,10 +1920,108 @@ moveAction:
     processPlayerInput(action, name);
 }
 
+void BucketQueue::init(const int numBuckets, const int maxItems)
+{
+    assert(numBuckets > 0 && (numBuckets & (numBuckets - 1)) == 0);
+    heads.resize(numBuckets);
+    keys.resize(maxItems);
+    values.resize(maxItems);
+    nexts.resize(maxItems);
+    clear();
+}
+
+void BucketQueue::clear()
+{
+    for(int& head: heads)
+        head = -1;
+
+    freeHead = -1;
+    numUsed = 0;
+    size = 0;
+    minKey = 0;
+}
+
+bool BucketQueue::push(const int key, const int value)
+{
+    if(key < minKey || key >= minKey + heads.size())
+    {
+        assert(false);
+        return false;
+    }
+
+    int item;
+
+    if(freeHead != -1)
+    {
+        item = freeHead;
+        freeHead = nexts[item];
+    }
+    else if(numUsed < keys.size())
+    {
+        item = numUsed;
+        ++numUsed;
+    }
+    else
+    {
+        assert(false);
+        return false;
+    }
+
+    // all the keys in the window are different modulo the number of buckets, one key per bucket
+    const int bucket = key & (heads.size() - 1);
+    keys[item] = key;
+    values[item] = value;
+    nexts[item] = heads[bucket];
+    heads[bucket] = item;
+    ++size;
+    return true;
+}
+
+bool BucketQueue::pop(int& key, int& value)
+{
+    if(size == 0)
+        return false;
+
+    const int mask = heads.size() - 1;
+
+    while(heads[minKey & mask] == -1)
+        ++minKey;
+
+    int* const head = &heads[minKey & mask];
+
+    // the bucket lists are short, find the item with the smallest value
+    int* link = head;
+    for(int* it = &nexts[*head]; *it != -1; it = &nexts[*it])
+    {
+        if(values[*it] < values[*link])
+            link = it;
+    }
+
+    const int item = *link;
+    *link = nexts[item];
+    key = keys[item];
+    value = values[item];
+    nexts[item] = freeHead;
+    freeHead = item;
+    --size;
+    return true;
+}
+
 inline double heuristic(ivec2 a, ivec2 b) {
   return std::abs(a.x - b.x) + std::abs(a.y - b.y);
 }
 
+int Simulation::findPlayer(const char* const name) const
+{
+    for(int i = 0; i < players_.size(); ++i)
+    {
+        if(strcmp(name, players_[i].name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
 void Simulation::processPlayerInput(const Action& action, const char* name)
 {
     if(timeToStart_ > 0.f)
@@ -607,16 +2057,7 @@ void Simulation::processPlayerInput(const Action& action, const char* name)
     if(action.drop)
     {
         const ivec2 targetTile = getPlayerTile(player, tileSize_);
-        bool freeTile = true;
-
-        for(const Bomb& bomb: bombs_)
-        {
-            if(bomb.tile == targetTile)
-            {
-                freeTile = false;
-                break;
-            }
-        }
+        const bool freeTile = occupancy_[targetTile.y][targetTile.x].bomb == -1;
 
         if(freeTile && player.dropCooldown == 0.f)
         {
@@ -634,16 +2075,182 @@ void Simulation::processPlayerInput(const Action& action, const char* name)
                 }
             }
 
+            occupancy_[targetTile.y][targetTile.x].bomb = bombs_.size();
             bombs_.pushBack(bomb);
+            dangerMap_.tick = -1;
+        }
+    }
+}
+
+const DangerMap& Simulation::getDangerMap()
+{
+    DangerMap& map = dangerMap_;
+
+    if(map.tick == tick_)
+        return map;
+
+    map.tick = tick_;
+    map.gameState.assign(tiles_);
+    map.timeToDetonation.fill(FLT_MAX);
+
+    float detonations[MaxBombs];
+
+    for(int i = 0; i < bombs_.size(); ++i)
+        detonations[i] = max(0.f, bombs_[i].timer);
+
+    // the blast rules are the same as in update(): a wall stops the blast, a crate is hit and
+    // stops the blast; a bomb hit by the blast explodes 0.1 s later (chain reaction)
+
+    for(bool changed = true; changed;)
+    {
+        changed = false;
+
+        for(int bombIdx = 0; bombIdx < bombs_.size(); ++bombIdx)
+        {
+            const Bomb& bomb = bombs_[bombIdx];
+
+            for(int dirIdx = Dir::Nil; dirIdx < Dir::Count; ++dirIdx)
+            {
+                const int range = (dirIdx != Dir::Nil) ? bomb.range : 1;
+
+                for(int step = 1; step <= range; ++step)
+                {
+                    const ivec2 tile = bomb.tile + ivec2(dirVecs_[dirIdx]) * step;
+
+                    if(tiles_.get(tile.x, tile.y) != 0)
+                        break;
+
+                    const int hitIdx = occupancy_[tile.y][tile.x].bomb;
+
+                    if(hitIdx != -1 && detonations[bombIdx] + 0.1f < detonations[hitIdx])
+                    {
+                        detonations[hitIdx] = detonations[bombIdx] + 0.1f;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    for(int bombIdx = 0; bombIdx < bombs_.size(); ++bombIdx)
+    {
+        const Bomb& bomb = bombs_[bombIdx];
+
+        for(int dirIdx = Dir::Nil; dirIdx < Dir::Count; ++dirIdx)
+        {
+            const int range = (dirIdx != Dir::Nil) ? bomb.range : 1;
+
+            for(int step = 1; step <= range; ++step)
+            {
+                const ivec2 tile = bomb.tile + ivec2(dirVecs_[dirIdx]) * step;
+                const int tileValue = tiles_.get(tile.x, tile.y);
+
+                if(tileValue == 2)
+                    break;
+
+                float& time = map.timeToDetonation[tile.y][tile.x];
+                time = min(time, detonations[bombIdx]);
+
+                if(tileValue == 1)
+                    break;
+
+                // Set tile to danger zone!
+                map.gameState.set(tile.x, tile.y, 3);
+            }
         }
     }
+
+    return map;
+}
+
+int packAction(const Action& action)
+{
+    return (action.up != 0) | (action.down != 0) << 1 | (action.left != 0) << 2 |
+           (action.right != 0) << 3 | (action.drop != 0) << 4;
+}
+
+Action unpackAction(const int bits)
+{
+    Action action;
+    action.up = bits & 1;
+    action.down = (bits >> 1) & 1;
+    action.left = (bits >> 2) & 1;
+    action.right = (bits >> 3) & 1;
+    action.drop = (bits >> 4) & 1;
+    return action;
+}
+
+static void hashBytes(unsigned& hash, const void* const data, const int size)
+{
+    for(int i = 0; i < size; ++i)
+        hash = (hash ^ ((const unsigned char*)data)[i]) * 16777619u;
+}
+
+template<typename T>
+static void hashValue(unsigned& hash, const T& value)
+{
+    hashBytes(hash, &value, sizeof(T));
+}
+
+unsigned hashSimulation(const Simulation& sim)
+{
+    unsigned hash = 2166136261u;
+    hashValue(hash, sim.tick_);
+    hashValue(hash, sim.timeToStart_);
+
+    // field by field, the padding is not initialized
+
+    for(const Player& player: sim.players_)
+    {
+        hashValue(hash, player.pos);
+        hashValue(hash, player.vel);
+        hashValue(hash, player.dir);
+        hashValue(hash, player.dropCooldown);
+        hashValue(hash, player.hp);
+        hashValue(hash, player.score);
+        hashValue(hash, player.dmgTimer);
+        hashValue(hash, player.prevDir);
+    }
+
+    for(const Bomb& bomb: sim.bombs_)
+    {
+        hashValue(hash, bomb.tile);
+        hashValue(hash, bomb.range);
+        hashValue(hash, bomb.timer);
+        hashValue(hash, bomb.playerIdxs);
+    }
+
+    const TileGrid& tiles = sim.tiles_;
+    hashBytes(hash, tiles.data(), tiles.wordsPerRow() * tiles.height() * sizeof(TileGrid::Word));
+    return hash;
+}
+
+int FixedStep::advance(const float frameDt)
+{
+    accumulator += frameDt;
+    int numSteps = 0;
+
+    while(accumulator >= stepDt)
+    {
+        accumulator -= stepDt;
+        ++numSteps;
+
+        if(numSteps == maxCatchUpSteps)
+        {
+            accumulator = fmodf(accumulator, stepDt);
+            break;
+        }
+    }
+
+    return numSteps;
 }
 
-bool Simulation::update(float dt, FixedArray<ExploEvent, 50>& exploEvents)
+bool Simulation::update(float dt, FixedArray<ExploEvent, MaxExploEvents>& exploEvents)
 {
+    ++tick_;
     timeToStart_ -= dt;
 
-    // @TODO(matiTechno): replace with 'gaffer on games' technique
+    // safety net for the variable timestep callers
     dt = min(dt, 0.033f);
 
     // bombs
@@ -664,7 +2271,7 @@ bool Simulation::update(float dt, FixedArray<ExploEvent, 50>& exploEvents)
             for(int step = 1; step <= range; ++step)
             {
                 const ivec2 tile = bomb.tile + ivec2(dir) * step;
-                int& tileValue = tiles_[tile.y][tile.x];
+                const int tileValue = tiles_.get(tile.x, tile.y);
 
                 if(tileValue == 2)
                 {
@@ -674,28 +2281,26 @@ bool Simulation::update(float dt, FixedArray<ExploEvent, 50>& exploEvents)
 
                 else if(tileValue == 1)
                 {
-                    tileValue = 0;
+                    tiles_.set(tile.x, tile.y, 0);
+                    tilesFromSeed_ = false;
                     exploEvents.pushBack({tile, ExploEvent::Crate});
                     break;
                 }
                 else
                 {
-                    bool hitBomb = false;
-                    // @ shadowing
-                    for(Bomb& bomb: bombs_)
-                    {
-                        if(bomb.tile == tile)
-                        {
-                            hitBomb = true;
-                            // explode in the near future
-                            bomb.timer = min(bomb.timer, 0.1f);
-                        }
-                    }
+                    const TileOccupancy& occupancy = occupancy_[tile.y][tile.x];
+                    const bool hitBomb = occupancy.bomb != -1;
+
+                    // explode in the near future
+                    if(hitBomb)
+                        bombs_[occupancy.bomb].timer = min(bombs_[occupancy.bomb].timer, 0.1f);
 
                     bool hitPlayer = false;
-                    for(Player& player: players_)
+                    for(int i = 0; i < players_.size(); ++i)
                     {
-                        if(getPlayerTile(player, tileSize_) == tile && player.hp)
+                        Player& player = players_[i];
+
+                        if((occupancy.players & (1 << i)) && player.hp)
                         {
                             player.hp -= 1;
                             player.dmgTimer = 1.2f;
@@ -717,8 +2322,13 @@ bool Simulation::update(float dt, FixedArray<ExploEvent, 50>& exploEvents)
                 }
             }
         }
+        occupancy_[bomb.tile.y][bomb.tile.x].bomb = -1;
         bomb = bombs_.back();
         bombs_.popBack();
+
+        if(bombIdx < bombs_.size())
+            occupancy_[bomb.tile.y][bomb.tile.x].bomb = bombIdx;
+
         --bombIdx;
     }
 
@@ -741,22 +2351,35 @@ bool Simulation::update(float dt, FixedArray<ExploEvent, 50>& exploEvents)
         const ivec2 playerTile = getPlayerTile(player, tileSize_);
 
         // * with bombs
+        // a player moves less than a tile per update(), so the bombs it collides with (or has
+        // just left) are on the tiles adjacent to playerTile; the order does not matter, the
+        // position is always snapped to playerTile
 
-        for(Bomb& bomb: bombs_)
+        for(int i = -1; i < 2; ++i)
         {
-            const bool collision = isCollision(player.pos, bomb.tile, tileSize_);
-            const bool allowed = bomb.findPlayer(playerIdx);
-
-            if(collision && !allowed)
-            {
-                if(dirVecs_[player.dir].x)
-                    player.pos.x = playerTile.x * tileSize_;
-                else
-                    player.pos.y = playerTile.y * tileSize_;
-            }
-            else if(!collision && allowed)
+            for(int j = -1; j < 2; ++j)
             {
-                bomb.removePlayer(playerIdx);
+                const ivec2 tile = playerTile + ivec2(i, j);
+                const int bombIdx = occupancy_[tile.y][tile.x].bomb;
+
+                if(bombIdx == -1)
+                    continue;
+
+                Bomb& bomb = bombs_[bombIdx];
+                const bool collision = isCollision(player.pos, bomb.tile, tileSize_);
+                const bool allowed = bomb.findPlayer(playerIdx);
+
+                if(collision && !allowed)
+                {
+                    if(dirVecs_[player.dir].x)
+                        player.pos.x = playerTile.x * tileSize_;
+                    else
+                        player.pos.y = playerTile.y * tileSize_;
+                }
+                else if(!collision && allowed)
+                {
+                    bomb.removePlayer(playerIdx);
+                }
             }
         }
 
@@ -770,7 +2393,7 @@ bool Simulation::update(float dt, FixedArray<ExploEvent, 50>& exploEvents)
             {
                 const ivec2 tile = playerTile + ivec2(i, j);
 
-                if(tiles_[tile.y][tile.x] != 0 && isCollision(player.pos, tile, tileSize_))
+                if(tiles_.get(tile.x, tile.y) != 0 && isCollision(player.pos, tile, tileSize_))
                 {
                     collision = true;
                     goto end;
@@ -791,8 +2414,8 @@ end:
             ivec2 slideTile;
 
             if( (length(offset) > tileSize_ / 4.f) &&
-                (tiles_[int(playerTile.y + dirVecs_[player.dir].y)]
-                       [int(playerTile.x + dirVecs_[player.dir].x)] != 0) )
+                (tiles_.get(int(playerTile.x + dirVecs_[player.dir].x),
+                            int(playerTile.y + dirVecs_[player.dir].y)) != 0) )
             {
                 slideTile = playerTile + ivec2(normalize(offset));
                 // @ matiTechno
@@ -803,10 +2426,11 @@ end:
 
             const vec2 slideTilePos = vec2(slideTile) * tileSize_;
 
-            // important: y first, x second
-            // check if a tile next to slideTile (in the player direction) is free
-            if(tiles_[int(slideTile.y + dirVecs_[player.dir].y)]
-                     [int(slideTile.x + dirVecs_[player.dir].x)] == 0)
+            // check if a tile next to slideTile (in the player direction) is free; the player
+            // can already be on slideTilePos (the slide direction would be NaN)
+            if(tiles_.get(int(slideTile.x + dirVecs_[player.dir].x),
+                          int(slideTile.y + dirVecs_[player.dir].y)) == 0 &&
+               player.pos != slideTilePos)
             {
                 const vec2 slideVec = slideTilePos - player.pos;
                 const vec2 slideDir = normalize(slideVec);
@@ -819,6 +2443,18 @@ end:
                     player.pos = slideTilePos;
             }
         }
+
+        // occupancy
+
+        const ivec2 newTile = getPlayerTile(player, tileSize_);
+        ivec2& oldTile = playerTiles_[playerIdx];
+
+        if(newTile != oldTile)
+        {
+            occupancy_[oldTile.y][oldTile.x].players &= ~(1 << playerIdx);
+            occupancy_[newTile.y][newTile.x].players |= 1 << playerIdx;
+            oldTile = newTile;
+        }
     }
 
     // score; game state
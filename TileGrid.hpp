@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Array.hpp"
+
+// map with 2 bits per tile (values 0 - 3), 32 tiles per word; every row starts at a new word so
+// the rows can be scanned word by word; the padding bits at the end of a row are always 0
+class TileGrid
+{
+public:
+    typedef unsigned long long Word;
+    enum {TilesPerWord = 32};
+
+    // all the tiles are set to 0
+    void resize(int width, int height)
+    {
+        assert(width >= 0 && height >= 0);
+        width_ = width;
+        height_ = height;
+        wordsPerRow_ = (width + TilesPerWord - 1) / TilesPerWord;
+        words_.resize(wordsPerRow_ * height);
+        memset(words_.data(), 0, words_.size() * sizeof(Word));
+    }
+
+    // resizes if needed
+    void assign(const TileGrid& other)
+    {
+        if(width_ != other.width_ || height_ != other.height_)
+            resize(other.width_, other.height_);
+
+        memcpy(words_.data(), other.words_.data(), words_.size() * sizeof(Word));
+    }
+
+    int get(int x, int y) const
+    {
+        assert(x >= 0 && x < width_ && y >= 0 && y < height_);
+        return (words_[y * wordsPerRow_ + x / TilesPerWord] >> (x % TilesPerWord * 2)) & 3;
+    }
+
+    void set(int x, int y, int value)
+    {
+        assert(x >= 0 && x < width_ && y >= 0 && y < height_);
+        assert(value >= 0 && value < 4);
+        Word& word = words_[y * wordsPerRow_ + x / TilesPerWord];
+        const int shift = x % TilesPerWord * 2;
+        word = (word & ~(Word(3) << shift)) | (Word(value) << shift);
+    }
+
+    // bit 2 * i is set if the tile x = wordIdx * TilesPerWord + i has the value
+    Word find(int y, int wordIdx, int value) const
+    {
+        const Word x = words_[y * wordsPerRow_ + wordIdx] ^ (LowBits * value);
+        return ~(x | (x >> 1)) & LowBits & rowMask(wordIdx);
+    }
+
+    // word by word
+    void replace(int from, int to)
+    {
+        for(int y = 0; y < height_; ++y)
+        {
+            for(int w = 0; w < wordsPerRow_; ++w)
+            {
+                const Word mask = find(y, w, from) * 3;
+                Word& word = words_[y * wordsPerRow_ + w];
+                word = (word & ~mask) | (LowBits * to & mask);
+            }
+        }
+    }
+
+    // wire format: 4 tiles per byte, the first one in the low bits
+    int rowBytes() const {return (width_ + 3) / 4;}
+
+    void getRowBytes(int y, unsigned char* bytes) const
+    {
+        const Word* const row = &words_[y * wordsPerRow_];
+
+        for(int i = 0; i < rowBytes(); ++i)
+            bytes[i] = row[i / 8] >> (i % 8 * 8);
+    }
+
+    void setRowBytes(int y, const unsigned char* bytes)
+    {
+        Word* const row = &words_[y * wordsPerRow_];
+
+        for(int w = 0; w < wordsPerRow_; ++w)
+            row[w] = 0;
+
+        for(int i = 0; i < rowBytes(); ++i)
+            row[i / 8] |= Word(bytes[i]) << (i % 8 * 8);
+
+        for(int w = 0; w < wordsPerRow_; ++w)
+            row[w] &= rowMask(w);
+    }
+
+    int width()       const {return width_;}
+    int height()      const {return height_;}
+    int size()        const {return width_ * height_;}
+    int wordsPerRow() const {return wordsPerRow_;}
+    const Word* data() const {return words_.data();} // wordsPerRow() * height() words
+
+private:
+    static const Word LowBits = 0x5555555555555555ull; // the low bit of every tile
+
+    int width_ = 0;
+    int height_ = 0;
+    int wordsPerRow_ = 0;
+    Array<Word> words_;
+
+    // the bits of the tiles inside the row
+    Word rowMask(int wordIdx) const
+    {
+        const int numTiles = width_ - wordIdx * TilesPerWord;
+        return numTiles >= TilesPerWord ? ~Word(0) : (Word(1) << (numTiles * 2)) - 1;
+    }
+};
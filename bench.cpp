@@ -0,0 +1,242 @@
+// headless Simulation benchmark, the matches are played by bots only
+// build: make bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <new>
+#include <algorithm>
+
+#include "Array.hpp"
+#include "Scene.hpp"
+#include "Simulation.cpp"
+
+// counts the malloc() / calloc() / realloc() calls of this translation unit (Array and the
+// operator new below, i.e. the std containers); the Makefile links with -Wl,--wrap for them
+static long long gNumAllocs = 0;
+
+extern "C"
+{
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(const size_t size)
+{
+    ++gNumAllocs;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(const size_t num, const size_t size)
+{
+    ++gNumAllocs;
+    return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void* const ptr, const size_t size)
+{
+    ++gNumAllocs;
+    return __real_realloc(ptr, size);
+}
+}
+
+void* operator new(const size_t size)
+{
+    void* const ptr = malloc(size ? size : 1);
+    assert(ptr);
+    return ptr;
+}
+
+void operator delete(void* const ptr) noexcept
+{
+    free(ptr);
+}
+
+long long getTimeNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct Stats
+{
+    double mean;
+    int p50;
+    int p99;
+    int max;
+};
+
+// sorts the samples
+Stats getStats(Array<int>& samples)
+{
+    assert(samples.size());
+    std::sort(samples.begin(), samples.end());
+
+    long long sum = 0;
+    for(const int sample: samples)
+        sum += sample;
+
+    Stats stats;
+    stats.mean = double(sum) / samples.size();
+    stats.p50 = samples[samples.size() / 2];
+    stats.p99 = samples[min(samples.size() - 1, int(samples.size() * 0.99))];
+    stats.max = samples.back();
+    return stats;
+}
+
+void printStats(const char* const name, const Stats& stats)
+{
+    printf("%-26s mean %9.0f ns   p50 %9d ns   p99 %9d ns   max %9d ns\n", name, stats.mean,
+           stats.p50, stats.p99, stats.max);
+}
+
+// Array::insert() / erase() used to move sizeof(T) times too few bytes, int catches that
+bool checkArray()
+{
+    Array<int> array;
+    for(int i = 0; i < 5; ++i)
+        array.pushBack(i * 10);
+
+    array.insert(1, 5); // grows: 0 5 10 20 30 40
+    array.insert(6, 50); // at the end: 0 5 10 20 30 40 50
+    array.erase(3, 2); // 0 5 10 40 50
+    array.erase(0); // 5 10 40 50
+
+    const int expected[] = {5, 10, 40, 50};
+    return array.size() == 4 && memcmp(array.data(), expected, sizeof(expected)) == 0;
+}
+
+void printUsage()
+{
+    printf("usage: bench [options]\n"
+           "  --matches <n>  number of matches, played one after another (default 8)\n"
+           "  --ticks <n>    simulation steps per match (default 10000)\n"
+           "  --seed <n>     Simulation seed of the first match, + 1 per match (default 1)\n"
+           "  --map-size <w>x<h>  odd values in [%d, %d] (default 13x13)\n"
+           "exits with 1 if Simulation allocated during the ticks or the Array check failed\n",
+           int(Simulation::MinMapSize), int(Simulation::MaxMapSize));
+}
+
+int main(int argc, char** argv)
+{
+    int numMatches = 8;
+    int numTicks = 10000;
+    int seed = 1;
+    int mapWidth = Simulation::LegacyMapSize;
+    int mapHeight = Simulation::LegacyMapSize;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        const bool hasValue = i + 1 < argc;
+
+        if(hasValue && strcmp(argv[i], "--matches") == 0)
+            numMatches = max(1, atoi(argv[++i]));
+
+        else if(hasValue && strcmp(argv[i], "--ticks") == 0)
+            numTicks = max(1, atoi(argv[++i]));
+
+        else if(hasValue && strcmp(argv[i], "--seed") == 0)
+            seed = atoi(argv[++i]);
+
+        else if(hasValue && strcmp(argv[i], "--map-size") == 0 &&
+                sscanf(argv[i + 1], "%dx%d", &mapWidth, &mapHeight) == 2 &&
+                Simulation::isValidMapSize(mapWidth, mapHeight))
+        {
+            ++i;
+        }
+
+        else
+        {
+            printUsage();
+            return 0;
+        }
+    }
+
+    if(!checkArray())
+    {
+        printf("FAILED: Array::insert() / erase()\n");
+        return 1;
+    }
+
+    const FixedStep fixedStep;
+    const float dt = fixedStep.stepDt;
+
+    Array<int> updateSamples; // ns per Simulation::update()
+    Array<int> botSamples; // ns per Simulation::updateAndProcessBotInput()
+    Array<int> tickSamples; // ns per tick (bots + update)
+    updateSamples.reserve(numMatches * numTicks);
+    botSamples.reserve(numMatches * numTicks * MaxPlayers);
+    tickSamples.reserve(numMatches * numTicks);
+
+    long long numAllocs = 0;
+    int numRounds = 0;
+    FixedArray<ExploEvent, MaxExploEvents> exploEvents;
+
+    for(int match = 0; match < numMatches; ++match)
+    {
+        Simulation sim;
+        sim.rng_.setSeed(seed + match);
+        sim.setMapSize(mapWidth, mapHeight);
+        sim.players_.resize(MaxPlayers);
+
+        for(int i = 0; i < MaxPlayers; ++i)
+            snprintf(sim.players_[i].name, sizeof(sim.players_[i].name), "bot_%d", i);
+
+        sim.setNewGame();
+
+        // names are copied, players_ can be reordered by the simulation
+        char names[MaxPlayers][Player::NameBufSize];
+        for(int i = 0; i < MaxPlayers; ++i)
+            memcpy(names[i], sim.players_[i].name, Player::NameBufSize);
+
+        const long long prevNumAllocs = gNumAllocs;
+
+        for(int tick = 0; tick < numTicks; ++tick)
+        {
+            const long long tickBegin = getTimeNs();
+
+            for(int i = 0; i < MaxPlayers; ++i)
+            {
+                const long long begin = getTimeNs();
+                sim.updateAndProcessBotInput(names[i], dt);
+                botSamples.pushBack(int(getTimeNs() - begin));
+            }
+
+            exploEvents.clear();
+
+            const long long begin = getTimeNs();
+            const bool newRound = sim.update(dt, exploEvents);
+            const long long end = getTimeNs();
+
+            updateSamples.pushBack(int(end - begin));
+            tickSamples.pushBack(int(end - tickBegin));
+            numRounds += newRound;
+        }
+
+        numAllocs += gNumAllocs - prevNumAllocs;
+    }
+
+    const int totalTicks = numMatches * numTicks;
+
+    printf("%d matches x %d ticks (%d players, %dx%d map, dt %.4f s, seed %d), %d rounds "
+           "finished\n", numMatches, numTicks, int(MaxPlayers), mapWidth, mapHeight, dt, seed,
+           numRounds);
+
+    printStats("Simulation::update", getStats(updateSamples));
+    printStats("updateAndProcessBotInput", getStats(botSamples));
+    printStats("tick (bots + update)", getStats(tickSamples));
+    printf("allocations per tick: %.2f (%lld total)\n", double(numAllocs) / totalTicks,
+           numAllocs);
+
+    // the tick path (bots included) must not allocate, see PathScratch
+    if(numAllocs)
+    {
+        printf("FAILED: allocations on the tick path\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,530 @@
+// headless load generator: simulated players (a netcode::NetClient each) that send random or
+// scripted actions to a server; reports what the clients get back, to find the server limits
+// build: make loadgen
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <signal.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#include "Array.hpp"
+#include "Scene.hpp"
+#include "Simulation.cpp"
+#include "NetClient.cpp"
+
+using namespace netcode;
+
+double getTimeSec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void sleepUntil(const double time)
+{
+    timespec ts;
+    ts.tv_sec = time_t(time);
+    ts.tv_nsec = long((time - ts.tv_sec) * 1000000000.0);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+}
+
+// the action is held for duration seconds
+struct ScriptStep
+{
+    float duration;
+    Action action;
+};
+
+struct Options
+{
+    const char* host = "localhost";
+    int numClients = 100;
+    int numThreads = max(1, int(std::thread::hardware_concurrency()));
+    float connectRate = 100.f; // clients started per second
+    float duration = 30.f;
+    float updateRate = 60.f;
+    float pingInterval = 1.f;
+    float joinTimeout = 10.f; // see LoadClient::joined
+    unsigned seed = 1;
+    bool udp = false;
+    NetConditions netConditions;
+    Array<ScriptStep> script; // random actions if empty
+};
+
+// one simulated player
+struct LoadClient
+{
+    NetClient* net;
+    char name[Player::NameBufSize];
+    double startTime; // the first update()
+    Rng rng;
+    Action action;
+    float actionTimer = 0.f; // to the next action
+    int scriptStep = -1;
+    float pingTimer = 0.f;
+    // in a game with a snapshot; a client that has not joined Options::joinTimeout seconds after
+    // its start is stuck (a failure), whatever the connect counters say
+    bool joined = false;
+};
+
+// the client statistics summed over the clients of a worker, see NetClient
+struct Totals
+{
+    long long numBytesSent = 0;
+    long long numBytesReceived = 0;
+    long long numSnapshots = 0;
+    int numConnects = 0;
+    int numConnectFailures = 0;
+    int numDisconnects = 0;
+    int numStarted = 0;
+    int numConnected = 0;
+    int numInGame = 0;
+    int numJoined = 0;
+    int numStuck = 0;
+    double busyTime = 0.0; // seconds of the worker thread spent on the updates
+
+    void add(const Totals& other)
+    {
+        numBytesSent += other.numBytesSent;
+        numBytesReceived += other.numBytesReceived;
+        numSnapshots += other.numSnapshots;
+        numConnects += other.numConnects;
+        numConnectFailures += other.numConnectFailures;
+        numDisconnects += other.numDisconnects;
+        numStarted += other.numStarted;
+        numConnected += other.numConnected;
+        numInGame += other.numInGame;
+        numJoined += other.numJoined;
+        numStuck += other.numStuck;
+        busyTime += other.busyTime;
+    }
+};
+
+// updates its clients at Options::updateRate
+struct Worker
+{
+    std::thread thread;
+    Array<LoadClient> clients;
+    std::mutex mutex; // totals, rtts
+    Totals totals; // of the last update
+    Array<float> rtts; // ms, the pongs since the last report
+};
+
+static volatile int gExitLoop = false;
+void sigHandler(int) {gExitLoop = true;}
+
+void nextAction(LoadClient& client, const Options& options)
+{
+    if(options.script.size())
+    {
+        client.scriptStep = (client.scriptStep + 1) % options.script.size();
+        const ScriptStep& step = options.script[client.scriptStep];
+        client.action = step.action;
+        client.actionTimer += step.duration;
+        return;
+    }
+
+    // a random direction (or none) for 0.2 - 1 s, a bomb now and then
+    Action action;
+
+    switch(client.rng.getInt(0, 4))
+    {
+        case 0: action.up = true; break;
+        case 1: action.down = true; break;
+        case 2: action.left = true; break;
+        case 3: action.right = true; break;
+    }
+
+    action.drop = client.rng.getInt(0, 9) == 0;
+    client.action = action;
+    client.actionTimer += client.rng.getInt(200, 1000) / 1000.f;
+}
+
+void runWorker(Worker* const worker_, const Options* const options_,
+               const std::atomic<bool>* const stop)
+{
+    Worker& worker = *worker_;
+    const Options& options = *options_;
+    FixedArray<ExploEvent, MaxExploEvents> exploEvents; // not used
+    Array<float> rtts;
+    const double frameDt = 1.0 / options.updateRate;
+    double prevTime = getTimeSec();
+    double frameTime = prevTime;
+    double busyTime = 0.0;
+
+    while(!*stop)
+    {
+        const double time = getTimeSec();
+        const float dt = time - prevTime;
+        prevTime = time;
+        Totals totals;
+
+        for(LoadClient& client: worker.clients)
+        {
+            if(time < client.startTime)
+                continue;
+
+            NetClient& net = *client.net;
+
+            client.actionTimer -= dt;
+
+            while(client.actionTimer <= 0.f)
+                nextAction(client, options);
+
+            client.pingTimer += dt;
+
+            if(!net.hasToReconnect && client.pingTimer >= options.pingInterval)
+            {
+                client.pingTimer = 0.f;
+                net.ping();
+            }
+
+            // a reconnect also clears pingTime
+            const bool pinging = !net.hasToReconnect && net.pingTime >= 0.0;
+
+            exploEvents.clear();
+            net.update(dt, client.name, exploEvents, client.action);
+
+            if(pinging && net.pingTime < 0.0)
+                rtts.pushBack(net.rtt * 1000.f);
+
+            client.joined = client.joined || (net.inGame && net.numSnapshots);
+
+            totals.numBytesSent += net.numBytesSent;
+            totals.numBytesReceived += net.numBytesReceived;
+            totals.numSnapshots += net.numSnapshots;
+            totals.numConnects += net.numConnects;
+            totals.numConnectFailures += net.numConnectFailures;
+            totals.numDisconnects += net.numDisconnects;
+            totals.numStarted += 1;
+            totals.numConnected += net.connected && !net.hasToReconnect;
+            totals.numInGame += net.inGame;
+            totals.numJoined += client.joined;
+            totals.numStuck += !client.joined && time - client.startTime > options.joinTimeout;
+        }
+
+        busyTime += getTimeSec() - time;
+        totals.busyTime = busyTime;
+
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.totals = totals;
+
+            for(const float rtt: rtts)
+                worker.rtts.pushBack(rtt);
+        }
+
+        rtts.clear();
+
+        // the lost frames are not made up for
+        frameTime = max(frameTime + frameDt, getTimeSec());
+        sleepUntil(frameTime);
+    }
+}
+
+// sorts the samples; ms
+void printRtts(Array<float>& rtts)
+{
+    if(rtts.empty())
+    {
+        printf("  %6s %6s %6s", "-", "-", "-");
+        return;
+    }
+
+    std::sort(rtts.begin(), rtts.end());
+    printf("  %6.1f %6.1f %6.1f", rtts[rtts.size() / 2],
+           rtts[min(rtts.size() - 1, int(rtts.size() * 0.99))], rtts.back());
+}
+
+// a line is "<seconds> <keys>", keys - any of udlrb (up, down, left, right, bomb) or - for none;
+// the empty lines and the ones starting with # are skipped
+bool readScript(const char* const filename, Array<ScriptStep>& script)
+{
+    FILE* const file = fopen(filename, "r");
+
+    if(!file)
+    {
+        perror("fopen() failed");
+        return false;
+    }
+
+    char line[256];
+    int lineIdx = 0;
+    bool error = false;
+
+    while(!error && fgets(line, sizeof(line), file))
+    {
+        ++lineIdx;
+        ScriptStep step;
+        char keys[8];
+
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if(sscanf(line, "%f %7s", &step.duration, keys) != 2 || step.duration <= 0.f)
+            error = true;
+
+        for(const char* key = keys; !error && *key != '\0'; ++key)
+        {
+            switch(*key)
+            {
+                case 'u': step.action.up = true; break;
+                case 'd': step.action.down = true; break;
+                case 'l': step.action.left = true; break;
+                case 'r': step.action.right = true; break;
+                case 'b': step.action.drop = true; break;
+                case '-': break;
+                default: error = true;
+            }
+        }
+
+        if(!error)
+            script.pushBack(step);
+    }
+
+    fclose(file);
+
+    if(error)
+        printf("%s:%d: expected \"<seconds> <keys>\"\n", filename, lineIdx);
+
+    else if(script.empty())
+    {
+        printf("%s has no steps\n", filename);
+        error = true;
+    }
+
+    return !error;
+}
+
+void printUsage()
+{
+    printf("usage: loadgen [options]\n"
+           "  --host <host>           server address (default localhost)\n"
+           "  --clients <n>           simulated players (default 100)\n"
+           "  --threads <n>           client threads (default: number of cpus)\n"
+           "  --connect-rate <n>      clients started per second (default 100)\n"
+           "  --duration <s>          seconds from the first client start (default 30)\n"
+           "  --update-rate <hz>      NetClient::update() calls per second (default 60)\n"
+           "  --ping-interval <s>     seconds between the RTT pings of a client (default 1),\n"
+           "                          the resolution is one update\n"
+           "  --join-timeout <s>      a client not in a game with a snapshot this long after\n"
+           "                          its start is stuck (default 10)\n"
+           "  --seed <n>              seed of the random actions (default 1)\n"
+           "  --script <path>         actions from a file instead of random ones, one\n"
+           "                          \"<seconds> <keys>\" per line, keys are any of udlrb\n"
+           "                          (up, down, left, right, bomb) or - for none; looped\n"
+           "  --udp                   use the UDP transport (UdpLink)\n"
+           "  --net-sim <conditions>  simulate a bad network on the sent data, see server\n"
+           "prints per second: the clients started, connected (the server has answered) and\n"
+           "in a game, the snapshots per second of an in-game client, the ping RTT (ms, p50\n"
+           "p99 max), the traffic of all the clients, the failed connects, the lost\n"
+           "connections, the stuck clients and the load of the client threads (busy, %% of\n"
+           "the time); exits with 1 if a connect failed, a connection was lost, a client got\n"
+           "stuck or none joined\n");
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        const bool hasValue = i + 1 < argc;
+
+        if(hasValue && strcmp(argv[i], "--host") == 0)
+            options.host = argv[++i];
+
+        else if(hasValue && strcmp(argv[i], "--clients") == 0)
+            options.numClients = max(1, atoi(argv[++i]));
+
+        else if(hasValue && strcmp(argv[i], "--threads") == 0)
+            options.numThreads = max(1, atoi(argv[++i]));
+
+        else if(hasValue && strcmp(argv[i], "--connect-rate") == 0)
+            options.connectRate = max(0.1f, float(atof(argv[++i])));
+
+        else if(hasValue && strcmp(argv[i], "--duration") == 0)
+            options.duration = max(0.f, float(atof(argv[++i])));
+
+        else if(hasValue && strcmp(argv[i], "--update-rate") == 0)
+            options.updateRate = max(1.f, float(atof(argv[++i])));
+
+        else if(hasValue && strcmp(argv[i], "--ping-interval") == 0)
+            options.pingInterval = max(0.f, float(atof(argv[++i])));
+
+        else if(hasValue && strcmp(argv[i], "--join-timeout") == 0)
+            options.joinTimeout = max(0.f, float(atof(argv[++i])));
+
+        else if(hasValue && strcmp(argv[i], "--seed") == 0)
+            options.seed = strtoul(argv[++i], nullptr, 10);
+
+        else if(hasValue && strcmp(argv[i], "--script") == 0)
+        {
+            if(!readScript(argv[++i], options.script))
+                return 1;
+        }
+
+        else if(strcmp(argv[i], "--udp") == 0)
+            options.udp = true;
+
+        else if(hasValue && strcmp(argv[i], "--net-sim") == 0 &&
+                parseNetConditions(argv[i + 1], options.netConditions))
+        {
+            ++i;
+        }
+
+        else
+        {
+            printUsage();
+            return 0;
+        }
+    }
+
+    if(strlen(options.host) >= sizeof(NetClient::host))
+    {
+        printf("the host name is too long\n");
+        return 1;
+    }
+
+    options.numThreads = min(options.numThreads, options.numClients);
+
+    signal(SIGINT, sigHandler);
+    signal(SIGTERM, sigHandler);
+    // a write to a connection reset by the server is an error, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    // getaddrinfo() blocks, the clients don't resolve the host on their threads
+    HostAddrs hostAddrs;
+    Array<char> logBuf;
+
+    if(!resolveHost(logBuf, options.host, options.udp, hostAddrs))
+    {
+        printf("%.*s", logBuf.size(), logBuf.data());
+        return 1;
+    }
+
+    // NetClient is big and not movable
+    NetClient* const nets = new NetClient[options.numClients];
+    Worker* const workers = new Worker[options.numThreads];
+    std::atomic<bool> stop {false};
+    const double startTime = getTimeSec();
+
+    // the clients are dealt to the workers, so the ones started together are spread
+    for(int i = 0; i < options.numClients; ++i)
+    {
+        NetClient& net = nets[i];
+        snprintf(net.host, sizeof(net.host), "%s", options.host);
+        net.hostAddrs = hostAddrs;
+        net.udp = options.udp;
+        net.netConditions = options.netConditions;
+
+        Worker& worker = workers[i % options.numThreads];
+        worker.clients.pushBack({});
+        LoadClient& client = worker.clients.back();
+        client.net = &net;
+        snprintf(client.name, sizeof(client.name), "load_%d", i);
+        client.startTime = startTime + i / options.connectRate;
+        client.rng.setSeed((unsigned long long)options.seed << 32 | i);
+    }
+
+    for(int i = 0; i < options.numThreads; ++i)
+        workers[i].thread = std::thread(runWorker, &workers[i], &options, &stop);
+
+    printf("%d clients (%s, %d threads), %s:3000\n", options.numClients,
+           options.udp ? "UDP" : "TCP", options.numThreads, options.host);
+
+    printf("%6s %7s %9s %7s %6s  %6s %6s %6s %9s %9s %6s %6s %6s %5s\n", "time", "started",
+           "connected", "in-game", "snap/s", "rtt", "p99", "max", "sent kB/s", "recv kB/s",
+           "fails", "lost", "stuck", "busy");
+
+    const double reportInterval = 1.0;
+    double reportTime = startTime;
+    double prevReportTime = startTime; // the real one
+    Totals prev;
+    Array<float> rtts; // of the report
+    Array<float> allRtts;
+
+    while(!gExitLoop && reportTime - startTime < options.duration)
+    {
+        reportTime = min(reportTime + reportInterval, startTime + options.duration);
+        sleepUntil(reportTime);
+
+        Totals totals;
+
+        for(int i = 0; i < options.numThreads; ++i)
+        {
+            Worker& worker = workers[i];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            totals.add(worker.totals);
+
+            for(const float rtt: worker.rtts)
+                rtts.pushBack(rtt);
+
+            worker.rtts.clear();
+        }
+
+        const double time = getTimeSec();
+        const double interval = max(0.001, time - prevReportTime);
+        prevReportTime = time;
+
+        printf("%6.1f %7d %9d %7d %6.1f", reportTime - startTime, totals.numStarted,
+               totals.numConnected, totals.numInGame,
+               (totals.numSnapshots - prev.numSnapshots) / interval / max(1, totals.numInGame));
+
+        for(const float rtt: rtts)
+            allRtts.pushBack(rtt);
+
+        printRtts(rtts);
+        rtts.clear();
+
+        printf(" %9.1f %9.1f %6d %6d %6d %4.0f%%\n",
+               (totals.numBytesSent - prev.numBytesSent) / interval / 1000.0,
+               (totals.numBytesReceived - prev.numBytesReceived) / interval / 1000.0,
+               totals.numConnectFailures, totals.numDisconnects, totals.numStuck,
+               (totals.busyTime - prev.busyTime) / interval / options.numThreads * 100.0);
+
+        fflush(stdout);
+        prev = totals;
+    }
+
+    stop = true;
+
+    for(int i = 0; i < options.numThreads; ++i)
+        workers[i].thread.join();
+
+    const double seconds = max(0.001, getTimeSec() - startTime);
+
+    printf("total: %d connects, %d failed, %d lost, %d of %d joined, %d stuck; %.1f "
+           "snapshots/s per in-game client; sent %.1f kB/s, received %.1f kB/s\n",
+           prev.numConnects, prev.numConnectFailures, prev.numDisconnects, prev.numJoined,
+           prev.numStarted, prev.numStuck,
+           prev.numSnapshots / seconds / max(1, prev.numInGame),
+           prev.numBytesSent / seconds / 1000.0, prev.numBytesReceived / seconds / 1000.0);
+
+    printf("rtt (ms, p50 p99 max):");
+    printRtts(allRtts);
+    printf(", %d pings\n", allRtts.size());
+
+    // the clients started less than joinTimeout before the end are not stuck yet, but a run
+    // where nobody joined has failed anyway
+    const bool failed = prev.numConnectFailures || prev.numDisconnects || prev.numStuck ||
+                        !prev.numJoined;
+
+    delete[] workers;
+    delete[] nets;
+
+    if(failed)
+    {
+        printf("FAILED: connections failed or were lost, or clients did not join\n");
+        return 1;
+    }
+
+    return 0;
+}
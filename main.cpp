@@ -20,6 +20,7 @@
 #include "fmod/fmod_errors.h"
 
 // unity build
+#include "NetClient.cpp"
 #include "GameScene.cpp"
 #include "Simulation.cpp"
 #include "glad.c"
@@ -819,12 +820,6 @@ float getRandomFloat(const float min, const float max)
     return min + (max - min) * ( float(rand()) / float(RAND_MAX) );
 }
 
-int getRandomInt(const int min, const int max)
-{
-    assert(min <= max);
-    return min + rand() / (RAND_MAX / (max - min + 1) + 1);
-}
-
 int main()
 {
     glfwSetErrorCallback(errorCallback);
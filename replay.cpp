@@ -0,0 +1,246 @@
+// re-runs a match recorded by the server (--record) as fast as possible and checks the state
+// hash of every step, see ReplayRecord
+// build: make replay
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "Array.hpp"
+#include "Scene.hpp"
+#include "Simulation.cpp"
+
+using namespace netcode;
+
+long long getTimeNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+bool readFile(const char* const filename, Array<char>& buf)
+{
+    FILE* const file = fopen(filename, "rb");
+
+    if(!file)
+    {
+        perror("fopen() failed");
+        return false;
+    }
+
+    char chunk[4096];
+    int size;
+
+    while((size = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        const int prevSize = buf.size();
+        buf.resize(prevSize + size);
+        memcpy(buf.data() + prevSize, chunk, size);
+    }
+
+    const bool error = ferror(file);
+    fclose(file);
+
+    if(error)
+        printf("fread() failed\n");
+
+    return !error;
+}
+
+void printUsage()
+{
+    printf("usage: replay [options] <file>\n"
+           "  --continue  don't stop at the first hash mismatch\n"
+           "exits with 1 if the file is malformed or the simulation has diverged\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* filename = nullptr;
+    bool stopOnMismatch = true;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--continue") == 0)
+            stopOnMismatch = false;
+
+        else if(!filename && argv[i][0] != '-')
+            filename = argv[i];
+
+        else
+        {
+            printUsage();
+            return 0;
+        }
+    }
+
+    if(!filename)
+    {
+        printUsage();
+        return 0;
+    }
+
+    Array<char> buf;
+
+    if(!readFile(filename, buf))
+        return 1;
+
+    Reader r(buf.data(), buf.size());
+    char magic[4];
+    r.bytes(magic, sizeof(magic));
+    const int version = r.u8();
+    const float dt = r.f32();
+
+    if(r.error || memcmp(magic, "CTRP", 4) != 0)
+    {
+        printf("%s is not a replay file\n", filename);
+        return 1;
+    }
+
+    if(version != ReplayVersion)
+    {
+        printf("replay version %d is not supported (%d)\n", version, int(ReplayVersion));
+        return 1;
+    }
+
+    // the same calls in the same order as the server worker (processRoomMsg(), updateRoom())
+
+    Simulation sim;
+    FixedArray<ExploEvent, MaxExploEvents> exploEvents;
+    FixedArray<int, MaxPlayers> bots; // players_ indices
+    bool hasGame = false;
+    int numGames = 0;
+    int numSteps = 0;
+    int numInputs = 0;
+    int numMismatches = 0;
+    bool malformed = false;
+    long long simTime = 0;
+    const long long begin = getTimeNs();
+
+    while(r.it != r.end)
+    {
+        const int type = r.u8();
+
+        if(type == ReplayRecord::NewGame)
+        {
+            const int width = r.u8();
+            const int height = r.u8();
+            const unsigned seed = r.u32();
+            const int numPlayers = r.u8();
+
+            if(r.error || !Simulation::isValidMapSize(width, height) || numPlayers > MaxPlayers)
+            {
+                malformed = true;
+                break;
+            }
+
+            if(sim.tiles_.width() != width || sim.tiles_.height() != height)
+                sim.setMapSize(width, height);
+
+            sim.rng_.setSeed(seed);
+            sim.players_.clear();
+            bots.clear();
+
+            for(int i = 0; i < numPlayers; ++i)
+            {
+                if(r.u8())
+                    bots.pushBack(i);
+
+                const int nameLen = r.u8();
+
+                if(nameLen >= Player::NameBufSize)
+                {
+                    r.error = true;
+                    break;
+                }
+
+                sim.players_.pushBack({}); // the name is zeroed
+                r.bytes(sim.players_.back().name, nameLen);
+            }
+
+            if(r.error)
+            {
+                malformed = true;
+                break;
+            }
+
+            sim.setNewGame();
+            hasGame = true;
+            ++numGames;
+        }
+        else if(type == ReplayRecord::Input)
+        {
+            const int playerIdx = r.u8();
+            const Action action = unpackAction(r.u8());
+
+            if(r.error || !hasGame || playerIdx >= sim.players_.size())
+            {
+                malformed = true;
+                break;
+            }
+
+            sim.processPlayerInput(action, sim.players_[playerIdx].name);
+            ++numInputs;
+        }
+        else if(type == ReplayRecord::Step)
+        {
+            const unsigned hash = r.u32();
+
+            if(r.error || !hasGame)
+            {
+                malformed = true;
+                break;
+            }
+
+            const long long stepBegin = getTimeNs();
+
+            for(const int idx: bots)
+                sim.updateAndProcessBotInput(sim.players_[idx].name, dt);
+
+            exploEvents.clear();
+            sim.update(dt, exploEvents);
+            simTime += getTimeNs() - stepBegin;
+            ++numSteps;
+
+            if(hashSimulation(sim) != hash)
+            {
+                ++numMismatches;
+                printf("hash mismatch at step %d (game %d, tick %d)\n", numSteps, numGames,
+                       sim.tick_);
+
+                if(stopOnMismatch)
+                    break;
+            }
+        }
+        else
+        {
+            malformed = true;
+            break;
+        }
+    }
+
+    const double seconds = (getTimeNs() - begin) / 1000000000.0;
+
+    printf("%d games, %d steps (%.1f s of play), %d inputs, %d mismatches\n", numGames,
+           numSteps, numSteps * dt, numInputs, numMismatches);
+
+    printf("replayed in %.3f s, %.0f ns per step (bots + update)\n", seconds,
+           numSteps ? double(simTime) / numSteps : 0.0);
+
+    if(malformed)
+    {
+        printf("FAILED: malformed record at byte %d\n", int(r.it - buf.data()));
+        return 1;
+    }
+
+    if(numMismatches)
+    {
+        printf("FAILED: the simulation has diverged\n");
+        return 1;
+    }
+
+    return 0;
+}
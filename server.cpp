@@ -11,20 +11,22 @@
 #include <signal.h>
 #include <time.h>
 #include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
 
 #include "Array.hpp"
+#include "Queue.hpp"
+#include "SendQueue.hpp"
 #include "Scene.hpp"
 #include "Simulation.cpp"
 
 using namespace netcode;
 
-// code duplication with main.cpp
-int getRandomInt(const int min, const int max)
-{
-    assert(min <= max);
-    return min + rand() / (RAND_MAX / (max - min + 1) + 1);
-}
-
 double getTimeSec()
 {
     timespec ts;
@@ -44,55 +46,1420 @@ struct Client
 {
     ClientStatus status = ClientStatus::WaitingForInit;
     char name[Player::NameBufSize] = "dummy";
-    int sockfd;
+    int conn; // Reactor::conns slot
+    int room = -1; // rooms index, valid if InGame
+    int protocol = 0; // see Cmd::Protocol
+    int snapshotAck = 0; // delta compression baseline (binary protocol)
+    unsigned inputSeq = 0; // the newest binary Cmd::PlayerInput passed to the worker
     bool remove = false;
     bool alive = true;
 };
 
-struct Bot
+struct Bot
+{
+    char name[Player::NameBufSize];
+};
+
+// one match, the network thread part (the simulation runs on a worker, see RoomSim)
+// a room is closed when its last client leaves
+struct Room
+{
+    bool isFull() const {return numClients + bots.size() >= MaxPlayers;}
+
+    bool active = false;
+    char name[RoomNameBufSize];
+    int numClients = 0; // InGame clients with Client::room set to this room
+    bool needSetNewGame = false;
+    FixedArray<Bot, MaxPlayers> bots;
+    int mapWidth;
+    int mapHeight;
+    Rng rng; // the Simulation seeds, see setNewGame()
+};
+
+const char* getStatusStr(ClientStatus code)
+{
+    switch(code)
+    {
+        case ClientStatus::WaitingForInit: return "WaitingForInit";
+        case ClientStatus::Browser: return "Browser";
+        case ClientStatus::InGame:  return "InGame";
+        case ClientStatus::Lobby: return "Lobby";
+    }
+    assert(false);
+}
+
+bool wouldBlock()
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+enum
+{
+    MaxClients = 256,
+    MaxWorkers = 32,
+    MaxRecvBufSize = 10000 // the received bytes not processed yet, of a connection
+};
+
+// per-connection state; slots are stable, clients (swap-removed) are not
+struct Connection
+{
+    int sockfd = -1;
+    int clientIdx;
+    SendQueue sendBuf;
+    Array<char> recvBuf;
+    int recvBufNumUsed;
+    bool pollOut = false; // EPOLLOUT is registered, only while sendBuf is not empty
+    // changes with every new connection and room switch, the worker messages addressed to
+    // the old token are dropped
+    unsigned token = 0;
+    // the UDP connections share Reactor::udpfd (sockfd), they are found by UdpLink::id (see
+    // Reactor::udpTable)
+    bool udp = false;
+    UdpLink link;
+    sockaddr_storage addr; // of the newest packet, it can change (mobile networks)
+    socklen_t addrLen;
+    NetShim shim; // the outgoing data with Reactor::netConditions (--net-sim)
+};
+
+// epoll_event.data.u32 is a connection slot or one of these
+enum
+{
+    ListenToken = MaxClients,
+    TimerToken,
+    NotifyToken,
+    UdpToken
+};
+
+// Reactor::udpTable
+enum
+{
+    UdpTableBits = 9,
+    UdpTableSize = 1 << UdpTableBits
+};
+
+static_assert(UdpTableSize >= 2 * MaxClients, "UdpTableSize is too small");
+
+// the ids of one process are consecutive (see NetClient), the multiplicative hash spreads them
+static unsigned hashUdpId(const unsigned id)
+{
+    return (id * 2654435761u) >> (32 - UdpTableBits);
+}
+
+// a keyed hash of the connection id (see UdpChallengeMagic); not cryptographic, it only has to
+// be unknown to whoever does not receive the packets sent to the client address
+static unsigned makeUdpCookie(const unsigned long long (&secret)[2], const unsigned id)
+{
+    // two rounds of the splitmix64 finalizer
+    unsigned long long x = secret[0] ^ id;
+
+    for(int i = 0; i < 2; ++i)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        x += secret[1];
+    }
+
+    const unsigned cookie = x >> 32;
+    return cookie + !cookie; // 0 is the client without a cookie
+}
+
+// the timer interval while there are UDP connections, the reliable messages are resent and
+// acknowledged on the server loop iterations
+const double UdpTimerInterval = 0.02;
+// the same for the NetShim data that becomes due, it is the resolution of the simulated delays
+const double NetShimTimerInterval = 0.005;
+
+struct Reactor
+{
+    // returns false on failure
+    bool init(int listenfd, int udpfd);
+    void shutdown();
+    // returns the connection slot, -1 if there is no free one
+    int addConnection(int sockfd, int clientIdx);
+    int addUdpConnection(unsigned id, unsigned cookie, int clientIdx);
+    // returns -1 if there is no such connection
+    int findUdpConnection(unsigned id) const;
+    // the cookie a connect packet of this id must carry
+    unsigned getUdpCookie(unsigned id) const {return makeUdpCookie(udpSecret, id);}
+    void removeConnection(int conn);
+    // listening is turned off when there are no free connection slots
+    void setListening(bool on);
+    // seconds; the timer fires periodically
+    void setTimer(double interval);
+    // returns the number of timer expirations since the last call
+    int readTimer();
+    void readNotify();
+    // returns false on error; the UDP connections and the ones with data in the NetShim are
+    // flushed every server loop iteration (resends, acks, due data) even if sendBuf is empty
+    bool flush(int conn);
+
+    int epollfd = -1;
+    int listenfd = -1;
+    int udpfd = -1;
+    int timerfd = -1;
+    int notifyfd = -1; // eventfd, workers write to it when they have new messages
+    bool listening = false;
+    double timerInterval = 0.0;
+    NetConditions netConditions; // --net-sim, see NetShim
+    Array<char> msgs; // flush() scratch
+    Array<char> udpPacket; // flush() scratch
+    Array<char> udpRecvBuf; // UdpMaxDatagram bytes, the main loop recvfrom() scratch
+    unsigned long long udpSecret[2]; // the key of the cookies, random per server run
+    // the UDP connection slots by UdpLink::id, open addressing (hashUdpId()), -1 - empty
+    int udpTable[UdpTableSize];
+    Connection conns[MaxClients];
+};
+
+bool Reactor::init(const int listenfd_, const int udpfd_)
+{
+    listenfd = listenfd_;
+    udpfd = udpfd_;
+
+    epollfd = epoll_create1(0);
+    if(epollfd == -1)
+    {
+        perror("epoll_create1() failed");
+        return false;
+    }
+
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if(timerfd == -1)
+    {
+        perror("timerfd_create() failed");
+        return false;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = TimerToken;
+
+    if(epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &event) == -1)
+    {
+        perror("epoll_ctl() (timerfd) failed");
+        return false;
+    }
+
+    notifyfd = eventfd(0, EFD_NONBLOCK);
+    if(notifyfd == -1)
+    {
+        perror("eventfd() failed");
+        return false;
+    }
+
+    event.data.u32 = NotifyToken;
+
+    if(epoll_ctl(epollfd, EPOLL_CTL_ADD, notifyfd, &event) == -1)
+    {
+        perror("epoll_ctl() (notifyfd) failed");
+        return false;
+    }
+
+    event.data.u32 = UdpToken;
+
+    if(epoll_ctl(epollfd, EPOLL_CTL_ADD, udpfd, &event) == -1)
+    {
+        perror("epoll_ctl() (udpfd) failed");
+        return false;
+    }
+
+    udpRecvBuf.resize(UdpMaxDatagram);
+
+    if(getrandom(udpSecret, sizeof(udpSecret), 0) != sizeof(udpSecret))
+    {
+        perror("getrandom() failed");
+        return false;
+    }
+
+    for(int& idx: udpTable)
+        idx = -1;
+
+    for(Connection& conn: conns)
+    {
+        conn.sendBuf.reserve(500);
+        conn.recvBuf.resize(500);
+    }
+
+    setListening(true);
+    return true;
+}
+
+void Reactor::shutdown()
+{
+    for(Connection& conn: conns)
+    {
+        if(conn.sockfd != -1 && !conn.udp)
+            close(conn.sockfd);
+    }
+
+    if(timerfd != -1)
+        close(timerfd);
+
+    if(notifyfd != -1)
+        close(notifyfd);
+
+    if(epollfd != -1)
+        close(epollfd);
+}
+
+// every connection has its own (reproducible) delays and losses
+static unsigned long long getShimSeed(const NetConditions& conditions, const Connection& conn)
+{
+    return (unsigned long long)conditions.seed << 32 | conn.token;
+}
+
+int Reactor::addConnection(const int sockfd, const int clientIdx)
+{
+    for(int i = 0; i < MaxClients; ++i)
+    {
+        Connection& conn = conns[i];
+
+        if(conn.sockfd != -1)
+            continue;
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+
+        if(epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &event) == -1)
+        {
+            perror("epoll_ctl() (client) failed");
+            return -1;
+        }
+
+        conn.sockfd = sockfd;
+        conn.clientIdx = clientIdx;
+        conn.sendBuf.clear();
+        conn.recvBufNumUsed = 0;
+        conn.pollOut = false;
+        conn.udp = false;
+        ++conn.token;
+        conn.shim.reset(netConditions, getShimSeed(netConditions, conn), false);
+        return i;
+    }
+
+    return -1;
+}
+
+int Reactor::addUdpConnection(const unsigned id, const unsigned cookie, const int clientIdx)
+{
+    assert(findUdpConnection(id) == -1);
+
+    for(int i = 0; i < MaxClients; ++i)
+    {
+        Connection& conn = conns[i];
+
+        if(conn.sockfd != -1)
+            continue;
+
+        conn.sockfd = udpfd;
+        conn.clientIdx = clientIdx;
+        conn.sendBuf.clear();
+        conn.recvBufNumUsed = 0;
+        conn.pollOut = false;
+        conn.udp = true;
+        conn.link.reset(id, cookie);
+        ++conn.token;
+        conn.shim.reset(netConditions, getShimSeed(netConditions, conn), true);
+
+        unsigned idx = hashUdpId(id);
+
+        while(udpTable[idx] != -1)
+            idx = (idx + 1) & (UdpTableSize - 1);
+
+        udpTable[idx] = i;
+        return i;
+    }
+
+    return -1;
+}
+
+int Reactor::findUdpConnection(const unsigned id) const
+{
+    for(unsigned idx = hashUdpId(id); udpTable[idx] != -1; idx = (idx + 1) & (UdpTableSize - 1))
+    {
+        if(conns[udpTable[idx]].link.id == id)
+            return udpTable[idx];
+    }
+
+    return -1;
+}
+
+void Reactor::removeConnection(const int idx)
+{
+    Connection& conn = conns[idx];
+    assert(conn.sockfd != -1);
+
+    // this also removes the descriptor from the epoll set
+    if(!conn.udp)
+        close(conn.sockfd);
+    else
+    {
+        unsigned hole = hashUdpId(conn.link.id);
+
+        while(udpTable[hole] != idx)
+            hole = (hole + 1) & (UdpTableSize - 1);
+
+        // no tombstones: the following entries of the probe run that can't be reached from their
+        // home slot without the hole are moved into it
+        for(unsigned i = (hole + 1) & (UdpTableSize - 1); udpTable[i] != -1;
+            i = (i + 1) & (UdpTableSize - 1))
+        {
+            const unsigned home = hashUdpId(conns[udpTable[i]].link.id);
+
+            if( ((i - home) & (UdpTableSize - 1)) >= ((i - hole) & (UdpTableSize - 1)) )
+            {
+                udpTable[hole] = udpTable[i];
+                hole = i;
+            }
+        }
+
+        udpTable[hole] = -1;
+    }
+
+    conn.sockfd = -1;
+}
+
+void Reactor::setListening(const bool on)
+{
+    if(on == listening)
+        return;
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = ListenToken;
+
+    if(epoll_ctl(epollfd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, listenfd, &event) == -1)
+        perror("epoll_ctl() (listen) failed");
+    else
+        listening = on;
+}
+
+void Reactor::setTimer(const double interval)
+{
+    if(interval == timerInterval)
+        return;
+
+    timerInterval = interval;
+    itimerspec spec = {};
+    spec.it_interval.tv_sec = time_t(interval);
+    spec.it_interval.tv_nsec = long((interval - spec.it_interval.tv_sec) * 1000000000.0);
+    spec.it_value = spec.it_interval;
+
+    if(timerfd_settime(timerfd, 0, &spec, nullptr) == -1)
+        perror("timerfd_settime() failed");
+}
+
+int Reactor::readTimer()
+{
+    unsigned long long expirations = 0;
+
+    if(read(timerfd, &expirations, sizeof(expirations)) == -1 && !wouldBlock())
+        perror("read() (timerfd) failed");
+
+    return int(expirations);
+}
+
+void Reactor::readNotify()
+{
+    unsigned long long value;
+
+    if(read(notifyfd, &value, sizeof(value)) == -1 && !wouldBlock())
+        perror("read() (notifyfd) failed");
+}
+
+bool Reactor::flush(const int idx)
+{
+    Connection& conn = conns[idx];
+
+    const double time = getTimeSec();
+    const sockaddr* const addr = (const sockaddr*)&conn.addr;
+
+    if(conn.udp)
+    {
+        msgs.clear();
+        conn.sendBuf.moveTo(msgs);
+        conn.link.addMsgs(msgs.data(), msgs.size());
+
+        int size;
+
+        while( (size = conn.link.buildPacket(udpPacket, time)) )
+        {
+            if(conn.shim.isActive())
+                conn.shim.push(udpPacket.data(), size, time);
+
+            // a full socket buffer is a packet loss
+            else if(sendto(udpfd, udpPacket.data(), size, 0, addr, conn.addrLen) == -1 &&
+                    !wouldBlock())
+            {
+                perror("sendto() failed");
+            }
+        }
+
+        if(conn.shim.send(udpfd, time, addr, conn.addrLen) == -1)
+            perror("sendto() failed");
+
+        return true;
+    }
+
+    // the connection is written only by the shim, the server loop runs at least every
+    // NetShimTimerInterval
+    if(conn.shim.isActive())
+    {
+        if(conn.sendBuf.size())
+        {
+            msgs.clear();
+            conn.sendBuf.moveTo(msgs);
+            conn.shim.push(msgs.data(), msgs.size(), time);
+        }
+
+        if(conn.shim.send(conn.sockfd, time) == -1)
+        {
+            perror("send() failed");
+            return false;
+        }
+
+        return true;
+    }
+
+    if(conn.sendBuf.size())
+    {
+        const int rc = conn.sendBuf.send(conn.sockfd);
+
+        if(rc == -1)
+        {
+            // this can't be combined with the parent if
+            if(!wouldBlock())
+            {
+                perror("writev() failed");
+                return false;
+            }
+        }
+    }
+
+    const bool needPollOut = conn.sendBuf.size();
+
+    if(needPollOut != conn.pollOut)
+    {
+        epoll_event event = {};
+        event.events = needPollOut ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        event.data.u32 = idx;
+
+        if(epoll_ctl(epollfd, EPOLL_CTL_MOD, conn.sockfd, &event) == -1)
+        {
+            perror("epoll_ctl() (EPOLLOUT) failed");
+            return false;
+        }
+
+        conn.pollOut = needPollOut;
+    }
+
+    return true;
+}
+
+// a text message for several send queues, buf is the encoding scratch
+static MsgBlock* createBlock(Array<char>& buf, const int cmd, const char* const payload)
+{
+    buf.clear();
+    addMsg(buf, cmd, payload);
+    return MsgBlock::create(buf.data(), buf.size());
+}
+
+// the message is encoded once and queued by reference
+void addMsgToRoom(const FixedArray<Client, MaxClients>& clients, Connection* const conns,
+                  const int roomIdx, const int cmd, const char* const payload = "")
+{
+    static Array<char> buf; // the network thread only
+    MsgBlock* block = nullptr;
+
+    for(const Client& client: clients)
+    {
+        if(!client.remove && client.status == ClientStatus::InGame && client.room == roomIdx)
+        {
+            if(!block)
+                block = createBlock(buf, cmd, payload);
+
+            conns[client.conn].sendBuf.push(block);
+        }
+    }
+
+    if(block)
+        block->release();
+}
+
+// text Cmd::Simulation payload for the protocol 0 clients
+void encodeSimulationText(char* const buf, const int size, const Simulation& sim,
+                          const FixedArray<ExploEvent, MaxExploEvents>& exploEvents)
+{
+    // protocol:
+    // - time to start
+    // - num players
+    // - data for each player (name must not contain any white characters)
+    // - num bombs
+    // - data for each bomb
+    // - num explo events
+    // - data for each explo event
+    // 
+    // client can update the tiles based on exploEvents
+
+    int offset = 0;
+
+    const int numPlayers = sim.players_.size();
+
+    offset += sprintf(buf, "%f %d ", sim.timeToStart_, numPlayers);
+
+
+    for(int i = 0; i < numPlayers; ++i)
+    {
+        const Player& p = sim.players_[i];
+        offset += sprintf(buf + offset, "%f %f %f %d %f %d %d %s %f %d ",
+                p.pos.x, p.pos.y, p.vel, p.dir, p.dropCooldown, p.hp, p.score,
+                p.name, p.dmgTimer, p.prevDir);
+    }
+
+    offset += sprintf(buf + offset, "%d ", sim.bombs_.size());
+
+    for(const Bomb& b: sim.bombs_)
+    {
+        offset += sprintf(buf + offset, "%d %d %d %f %d %d ",
+                b.tile.x, b.tile.y, b.range, b.timer, b.playerIdxs[0],
+                b.playerIdxs[1]);
+    }
+
+    offset += sprintf(buf + offset, "%d ", exploEvents.size());
+
+    for(const ExploEvent& e: exploEvents)
+    {
+        offset += sprintf(buf + offset, "%d %d %d ", e.tile.x, e.tile.y, e.type);
+    }
+
+    const int numBytes = offset + 1; // null char
+    assert(numBytes <= size);
+    const int percentOccupied = int(float(numBytes) / size * 100.f);
+
+    if(percentOccupied > 50)
+    {
+        printf("SIMULATION: %d bytes used (%d%%), %d available\n", numBytes,
+                percentOccupied, size);
+    }
+}
+
+// room client as seen by the worker
+struct Member
+{
+    char name[Player::NameBufSize];
+    int conn;
+    unsigned token; // Connection::token
+    int protocol;
+    int snapshotAck; // delta compression baseline (binary protocol)
+    unsigned inputSeq; // the last processed Cmd::PlayerInput (client-side prediction)
+    int lastSentTick; // the last Cmd::Simulation, 0 - none in this round (see isSnapshotDue())
+    int unackedTick; // the oldest Cmd::Simulation not acknowledged, 0 - none (binary protocol)
+    bool udp; // the explo events are sent in Cmd::ExploEvents (binary protocol)
+};
+
+// the explo events are kept until every member has received them; members can have different
+// send rates (isSnapshotDue()), each Cmd::Simulation has the events since the previous one
+struct LoggedEvent
+{
+    int tick;
+    ExploEvent event;
+};
+
+// a binary client whose oldest unacknowledged snapshot is older than this (seconds) is sent only
+// one snapshot per MaxSnapshotLag until it catches up; a slow connection gets less frequent but
+// up to date snapshots instead of a backlog of stale ones in its sendBuf
+const float MaxSnapshotLag = 1.f;
+
+// one match, the worker thread part
+struct RoomSim
+{
+    bool active = false;
+    FixedArray<Member, MaxPlayers> members;
+    FixedArray<Bot, MaxPlayers> bots;
+    Simulation sim;
+    FixedArray<ExploEvent, MaxExploEvents> exploEvents; // updateRoom() scratch
+    Array<LoggedEvent> eventLog; // ordered by tick
+    SnapshotRing snapshots; // shared by the members, each one has its own baseline
+    // --record, see openReplay()
+    FILE* replayFile = nullptr;
+    Array<char> replayBuf; // written to replayFile in ReplayFlushSize chunks
+};
+
+enum {ReplayFlushSize = 1 << 16};
+
+// network thread -> worker
+struct RoomMsg
+{
+    enum
+    {
+        NewGame, // (re)starts the room with members and bots as the players
+        Close,
+        Input,
+        Ack
+    };
+
+    int type;
+    int room;
+    FixedArray<Member, MaxPlayers> members; // NewGame
+    FixedArray<Bot, MaxPlayers> bots; // NewGame
+    int mapWidth; // NewGame
+    int mapHeight; // NewGame
+    unsigned seed; // NewGame, Simulation::rng_ seed
+    char name[Player::NameBufSize]; // Input
+    Action action; // Input
+    unsigned inputSeq; // Input, 0 if the client does not send it
+    int conn; // Ack
+    unsigned token; // Ack
+    int tick; // Ack
+};
+
+// worker -> network thread, followed by size bytes of messages for the connection
+struct OutHeader
+{
+    int conn;
+    unsigned token; // the messages are dropped if Connection::token has changed
+    int size;
+    MsgBlock* block; // a shared message (see pushBlock()), the record has no payload
+};
+
+// each worker runs its own fixed step loop for the rooms it owns
+struct Worker
+{
+    std::thread thread;
+    int idx;
+    int numWorkers;
+    int wakefd = -1; // eventfd, the worker sleeps on it when it has no active rooms
+    int notifyfd; // Reactor::notifyfd
+    std::atomic<bool> exit {false};
+    FixedStep fixedStep;
+    int sendInterval; // simulation steps between the snapshots of a member (--send-rate)
+    RoomSim* rooms; // WorkerPool::roomSims
+    const char* recordPath; // --record, nullptr if the matches are not recorded
+    // sendInitTileData() / updateRoom() scratch
+    Array<char> payload;
+    Array<char> msg;
+    SpscQueue<RoomMsg, 256> in;
+    SpscByteQueue<1 << 18> out;
+};
+
+void notify(const int eventfd_)
+{
+    const unsigned long long value = 1;
+
+    if(write(eventfd_, &value, sizeof(value)) == -1 && !wouldBlock())
+        perror("write() (eventfd) failed");
+}
+
+// the record starts with OutHeader, the messages are appended with addMsg() / addBinaryMsg()
+void beginRecord(Array<char>& record)
+{
+    record.resize(sizeof(OutHeader));
+}
+
+// the record is dropped if the worker is stopped meanwhile (the network thread does not read
+// the queue anymore)
+static void writeOut(Worker& worker, const void* const data, const int size)
+{
+    while(!worker.out.write(data, size))
+    {
+        if(worker.exit)
+            return;
+
+        // the network thread is behind, make sure it is awake
+        notify(worker.notifyfd);
+        sched_yield();
+    }
+}
+
+void pushRecord(Worker& worker, const Member& member, Array<char>& record)
+{
+    OutHeader header;
+    header.conn = member.conn;
+    header.token = member.token;
+    header.size = record.size() - sizeof(OutHeader);
+    header.block = nullptr;
+    memcpy(record.data(), &header, sizeof(header));
+    writeOut(worker, record.data(), record.size());
+}
+
+// the messages sent to several members are encoded once, the network thread queues the block
+// by reference (the block reference is passed with the record)
+void pushBlock(Worker& worker, const Member& member, MsgBlock* const block)
+{
+    OutHeader header;
+    header.conn = member.conn;
+    header.token = member.token;
+    header.size = 0;
+    header.block = block;
+    block->retain();
+    writeOut(worker, &header, sizeof(header));
+}
+
+// protocol 0 clients get the text version, only the legacy map is sent to them; both versions
+// are encoded at most once and shared by the members
+void sendInitTileData(Worker& worker, const RoomSim& room)
+{
+    const TileGrid& tiles = room.sim.tiles_;
+    Array<char>& payload = worker.payload;
+    Array<char>& msg = worker.msg;
+    MsgBlock* binary = nullptr;
+    MsgBlock* text = nullptr;
+
+    for(const Member& member: room.members)
+    {
+        if(member.protocol == ProtocolVersion)
+        {
+            if(!binary)
+            {
+                payload.clear();
+                encodeTileData(payload, room.sim);
+                msg.clear();
+                addBinaryMsg(msg, Cmd::InitTileData, payload.data(), payload.size());
+                binary = MsgBlock::create(msg.data(), msg.size());
+            }
+
+            pushBlock(worker, member, binary);
+        }
+        else
+        {
+            assert(tiles.width() == Simulation::LegacyMapSize &&
+                   tiles.height() == Simulation::LegacyMapSize);
+
+            if(!text)
+            {
+                payload.resize(tiles.size() * 2); // for each value we add one space
+                char* it = payload.data();
+
+                for(int y = 0; y < tiles.height(); ++y)
+                {
+                    for(int x = 0; x < tiles.width(); ++x)
+                    {
+                        *it = tiles.get(x, y) + 48; // converting to ascii
+                        ++it;
+                        *it = ' ';
+                        ++it;
+                    }
+                }
+
+                payload.back() = '\0';
+                text = createBlock(msg, Cmd::InitTileData, payload.data());
+            }
+
+            pushBlock(worker, member, text);
+        }
+    }
+
+    if(binary)
+        binary->release();
+
+    if(text)
+        text->release();
+}
+
+void flushReplay(RoomSim& room)
+{
+    if(!room.replayFile || room.replayBuf.empty())
+        return;
+
+    if(fwrite(room.replayBuf.data(), 1, room.replayBuf.size(), room.replayFile) !=
+       size_t(room.replayBuf.size()))
+    {
+        perror("fwrite() (replay) failed");
+    }
+
+    room.replayBuf.clear();
+}
+
+// one file per room slot (<recordPath>.<room index>), created on the first NewGame; the rooms
+// that reuse the slot are appended (they also reuse the Simulation)
+// returns false if the room is not recorded
+bool openReplay(const Worker& worker, RoomSim& room, const int roomIdx)
+{
+    if(room.replayFile)
+        return true;
+
+    if(!worker.recordPath)
+        return false;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s.%d", worker.recordPath, roomIdx);
+    room.replayFile = fopen(path, "wb");
+
+    if(!room.replayFile)
+    {
+        perror("fopen() (replay) failed");
+        return false;
+    }
+
+    Writer w(room.replayBuf);
+    w.bytes("CTRP", 4);
+    w.u8(ReplayVersion);
+    w.f32(worker.fixedStep.stepDt);
+    return true;
+}
+
+// after sim.players_ are set
+void recordNewGame(RoomSim& room, const RoomMsg& msg)
+{
+    const Simulation& sim = room.sim;
+    Writer w(room.replayBuf);
+    w.u8(ReplayRecord::NewGame);
+    w.u8(sim.tiles_.width());
+    w.u8(sim.tiles_.height());
+    w.u32(msg.seed);
+    w.u8(sim.players_.size());
+
+    for(int i = 0; i < sim.players_.size(); ++i)
+    {
+        const char* const name = sim.players_[i].name;
+        const int nameLen = strlen(name);
+        w.u8(i >= room.members.size());
+        w.u8(nameLen);
+        w.bytes(name, nameLen);
+    }
+}
+
+void recordInput(RoomSim& room, const RoomMsg& msg)
+{
+    const Simulation& sim = room.sim;
+
+    for(int i = 0; i < sim.players_.size(); ++i)
+    {
+        if(strcmp(sim.players_[i].name, msg.name) == 0)
+        {
+            Writer w(room.replayBuf);
+            w.u8(ReplayRecord::Input);
+            w.u8(i);
+            w.u8(packAction(msg.action));
+            return;
+        }
+    }
+}
+
+void processRoomMsg(Worker& worker, const RoomMsg& msg)
+{
+    RoomSim& room = worker.rooms[msg.room];
+
+    switch(msg.type)
+    {
+        case RoomMsg::NewGame:
+        {
+            // keep the baselines and the input seqs of the members that stay
+            FixedArray<Member, MaxPlayers> members = msg.members;
+
+            for(Member& member: members)
+            {
+                for(const Member& old: room.members)
+                {
+                    if(old.conn == member.conn && old.token == member.token)
+                    {
+                        member.snapshotAck = old.snapshotAck;
+                        member.inputSeq = old.inputSeq;
+                        member.unackedTick = old.unackedTick;
+                    }
+                }
+            }
+
+            room.active = true;
+            room.members = members;
+            room.bots = msg.bots;
+            room.eventLog.clear(); // the events of the previous map
+
+            Simulation& sim = room.sim;
+
+            if(sim.tiles_.width() != msg.mapWidth || sim.tiles_.height() != msg.mapHeight)
+                sim.setMapSize(msg.mapWidth, msg.mapHeight);
+
+            sim.rng_.setSeed(msg.seed);
+
+            sim.players_.clear();
+
+            for(const Member& member: room.members)
+            {
+                sim.players_.pushBack({});
+                memcpy(sim.players_.back().name, member.name, Player::NameBufSize);
+            }
+
+            for(const Bot& bot: room.bots)
+            {
+                sim.players_.pushBack({});
+                memcpy(sim.players_.back().name, bot.name, Player::NameBufSize);
+            }
+
+            if(openReplay(worker, room, msg.room))
+                recordNewGame(room, msg);
+
+            sim.setNewGame();
+            sendInitTileData(worker, room);
+            break;
+        }
+
+        case RoomMsg::Close:
+            room.active = false;
+            room.members.clear();
+            room.eventLog.clear();
+            room.snapshots.clear();
+            flushReplay(room);
+            break;
+
+        case RoomMsg::Input:
+            if(room.active)
+            {
+                room.sim.processPlayerInput(msg.action, msg.name);
+
+                for(Member& member: room.members)
+                {
+                    if(strcmp(member.name, msg.name) == 0)
+                        member.inputSeq = msg.inputSeq;
+                }
+
+                if(room.replayFile)
+                    recordInput(room, msg);
+            }
+
+            break;
+
+        case RoomMsg::Ack:
+        {
+            for(Member& member: room.members)
+            {
+                if(member.conn == msg.conn && member.token == msg.token)
+                {
+                    member.snapshotAck = min(msg.tick, room.sim.tick_);
+
+                    // the acks are cumulative, only the newest snapshot is acknowledged
+                    if(member.snapshotAck >= member.lastSentTick)
+                        member.unackedTick = 0;
+                    else if(member.unackedTick)
+                        member.unackedTick = max(member.unackedTick, member.snapshotAck + 1);
+                }
+            }
+
+            break;
+        }
+    }
+}
+
+static bool isSnapshotDue(const Worker& worker, const Member& member, const int tick)
+{
+    if(!member.lastSentTick)
+        return true;
+
+    int interval = worker.sendInterval;
+
+    // the text protocol has no acks
+    if(member.protocol == ProtocolVersion && member.unackedTick)
+    {
+        const int maxLag = int(MaxSnapshotLag / worker.fixedStep.stepDt);
+
+        if(tick - member.unackedTick > maxLag)
+            interval = max(interval, maxLag);
+    }
+
+    return tick - member.lastSentTick >= interval;
+}
+
+// the events logged after the tick, the oldest ones are dropped if there are too many
+static void getLoggedEvents(const RoomSim& room, const int tick,
+                            FixedArray<ExploEvent, MaxExploEvents>& exploEvents)
+{
+    int begin = room.eventLog.size();
+
+    while(begin > 0 && room.eventLog[begin - 1].tick > tick)
+        --begin;
+
+    begin = max(begin, room.eventLog.size() - exploEvents.maxSize());
+    exploEvents.clear();
+
+    for(int i = begin; i < room.eventLog.size(); ++i)
+        exploEvents.pushBack(room.eventLog[i].event);
+}
+
+// removes the events that every member has received
+static void trimEventLog(RoomSim& room)
+{
+    int minTick = room.sim.tick_;
+
+    for(const Member& member: room.members)
+        minTick = min(minTick, member.lastSentTick);
+
+    Array<LoggedEvent>& log = room.eventLog;
+    int numSent = 0;
+
+    while(numSent < log.size() && log[numSent].tick <= minTick)
+        ++numSent;
+
+    if(!numSent)
+        return;
+
+    for(int i = numSent; i < log.size(); ++i)
+        log[i - numSent] = log[i];
+
+    log.resize(log.size() - numSent);
+}
+
+// runs the simulation steps and sends the snapshots that are due to the room members
+void updateRoom(Worker& worker, RoomSim& room, const int numSteps, Array<char>& binaryBuf,
+                Array<char>& record)
+{
+    Simulation& sim = room.sim;
+    FixedArray<ExploEvent, MaxExploEvents>& exploEvents = room.exploEvents;
+    const float stepDt = worker.fixedStep.stepDt;
+
+    for(int step = 0; step < numSteps; ++step)
+    {
+        for(const Bot& bot: room.bots)
+            sim.updateAndProcessBotInput(bot.name, stepDt);
+
+        exploEvents.clear();
+        const bool newGame = sim.update(stepDt, exploEvents);
+
+        if(room.replayFile)
+        {
+            Writer w(room.replayBuf);
+            w.u8(ReplayRecord::Step);
+            w.u32(hashSimulation(sim));
+        }
+
+        if(newGame)
+        {
+            // the events of the previous map must not be applied to the new one
+            room.eventLog.clear();
+
+            for(Member& member: room.members)
+                member.lastSentTick = 0;
+
+            sendInitTileData(worker, room);
+        }
+        else
+        {
+            for(const ExploEvent& e: exploEvents)
+                room.eventLog.pushBack({sim.tick_, e});
+        }
+    }
+
+    if(room.replayBuf.size() >= ReplayFlushSize)
+        flushReplay(room);
+
+    // at most one snapshot per wake up, stamped with the last tick; the members that are not due
+    // get the newest state and all the events in between with their next one
+    Snapshot* snapshot = nullptr;
+
+    // players + bombs + explo events, the values are small (on the map tiles, timers)
+    char textBuf[1024 + MaxBombs * 48 + MaxExploEvents * 16];
+    // the text members have the same send schedule, the message is shared by the ones with the
+    // same previous snapshot (the same events)
+    MsgBlock* text = nullptr;
+    int textFrom = -1;
+
+    for(Member& member: room.members)
+    {
+        if(!isSnapshotDue(worker, member, sim.tick_))
+            continue;
+
+        if(!snapshot)
+        {
+            snapshot = &room.snapshots.add(sim.tick_);
+            takeSnapshot(*snapshot, sim);
+        }
+
+        if(member.protocol == ProtocolVersion)
+        {
+            beginRecord(record);
+            getLoggedEvents(room, member.lastSentTick, exploEvents);
+            binaryBuf.clear();
+
+            // the UDP snapshots can be lost, the events go on the reliable channel
+            if(member.udp)
+            {
+                if(exploEvents.size())
+                {
+                    encodeExploEvents(binaryBuf, exploEvents);
+                    addBinaryMsg(record, Cmd::ExploEvents, binaryBuf.data(), binaryBuf.size());
+                    binaryBuf.clear();
+                }
+
+                exploEvents.clear();
+            }
+
+            // delta against the last acknowledged snapshot, full snapshot if it is too old
+            encodeSimulation(binaryBuf, *snapshot, room.snapshots.find(member.snapshotAck),
+                             exploEvents, member.inputSeq);
+
+            addBinaryMsg(record, Cmd::Simulation, binaryBuf.data(), binaryBuf.size());
+            pushRecord(worker, member, record);
+
+            if(!member.unackedTick)
+                member.unackedTick = sim.tick_;
+        }
+        else
+        {
+            if(!text || textFrom != member.lastSentTick)
+            {
+                if(text)
+                    text->release();
+
+                getLoggedEvents(room, member.lastSentTick, exploEvents);
+                encodeSimulationText(textBuf, sizeof(textBuf), sim, exploEvents);
+                text = createBlock(worker.msg, Cmd::Simulation, textBuf);
+                textFrom = member.lastSentTick;
+            }
+
+            pushBlock(worker, member, text);
+        }
+
+        member.lastSentTick = sim.tick_;
+    }
+
+    if(text)
+        text->release();
+
+    trimEventLog(room);
+}
+
+void runWorker(Worker* const worker_)
+{
+    Worker& worker = *worker_;
+    Array<char> binaryBuf; // encoded Cmd::Simulation
+    Array<char> record;
+    double simTime = getTimeSec();
+
+    while(!worker.exit)
+    {
+        bool hasOutput = false;
+
+        {
+            RoomMsg msg;
+
+            while(worker.in.pop(msg))
+            {
+                processRoomMsg(worker, msg);
+                hasOutput = true;
+            }
+        }
+
+        bool active = false;
+
+        for(int r = worker.idx; r < MaxRooms; r += worker.numWorkers)
+        {
+            if(worker.rooms[r].active)
+            {
+                active = true;
+                break;
+            }
+        }
+
+        if(!active)
+        {
+            if(hasOutput)
+                notify(worker.notifyfd);
+
+            // wait for RoomMsg::NewGame or exit
+            unsigned long long value;
+            if(read(worker.wakefd, &value, sizeof(value)) == -1 && errno != EINTR)
+                perror("read() (wakefd) failed");
+
+            simTime = getTimeSec();
+            worker.fixedStep.accumulator = 0.f;
+            continue;
+        }
+
+        const double currentTime = getTimeSec();
+        const int numSteps = worker.fixedStep.advance(currentTime - simTime);
+        simTime = currentTime;
+
+        if(numSteps)
+        {
+            for(int r = worker.idx; r < MaxRooms; r += worker.numWorkers)
+            {
+                if(worker.rooms[r].active)
+                    updateRoom(worker, worker.rooms[r], numSteps, binaryBuf, record);
+            }
+
+            hasOutput = true;
+        }
+
+        if(hasOutput)
+            notify(worker.notifyfd);
+
+        // sleep until the next step
+        const float toNextStep = worker.fixedStep.stepDt - worker.fixedStep.accumulator;
+        timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = long(max(0.f, toNextStep) * 1000000000.f);
+        nanosleep(&ts, nullptr);
+    }
+
+    for(int r = worker.idx; r < MaxRooms; r += worker.numWorkers)
+    {
+        RoomSim& room = worker.rooms[r];
+
+        if(room.replayFile)
+        {
+            flushReplay(room);
+            fclose(room.replayFile);
+            room.replayFile = nullptr;
+        }
+    }
+}
+
+// rooms are assigned to the workers round-robin (room index % numWorkers)
+struct WorkerPool
+{
+    // returns false on failure; conns - see receive(); sendInterval - see Worker; pin - set
+    // the worker thread affinity (one cpu per worker); recordPath - see openReplay(), can be
+    // nullptr
+    bool start(int numWorkers, Connection* conns, int notifyfd, const FixedStep& fixedStep,
+               int sendInterval, bool pin, const char* recordPath);
+    void stop();
+    Worker& getWorker(int room) {return workers[room % numWorkers];}
+    // blocks if the worker queue is full, receive() is called meanwhile (the worker might be
+    // waiting for the space in its out queue)
+    void push(const RoomMsg& msg);
+    // for the messages that can be dropped, returns false if the worker queue is full
+    bool tryPush(const RoomMsg& msg);
+    // appends the worker messages to the connection send buffers
+    void receive();
+
+    Connection* conns = nullptr; // Reactor::conns
+    int numWorkers = 0;
+    Worker workers[MaxWorkers];
+    RoomSim roomSims[MaxRooms];
+};
+
+bool WorkerPool::start(const int numWorkers_, Connection* const conns_, const int notifyfd,
+                       const FixedStep& fixedStep, const int sendInterval, const bool pin,
+                       const char* const recordPath)
 {
-    char name[Player::NameBufSize];
-};
+    assert(numWorkers_ > 0 && numWorkers_ <= MaxWorkers);
+    conns = conns_;
+    const int numCpus = std::thread::hardware_concurrency();
+
+    // signals are handled by the network thread (epoll_wait() returns EINTR)
+    sigset_t set, oldSet;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, &oldSet);
+
+    for(int i = 0; i < numWorkers_; ++i)
+    {
+        Worker& worker = workers[i];
+        worker.idx = i;
+        worker.numWorkers = numWorkers_;
+        worker.notifyfd = notifyfd;
+        worker.fixedStep = fixedStep;
+        worker.sendInterval = sendInterval;
+        worker.rooms = roomSims;
+        worker.recordPath = recordPath;
+        worker.wakefd = eventfd(0, 0);
+
+        if(worker.wakefd == -1)
+        {
+            perror("eventfd() (wakefd) failed");
+            break;
+        }
 
-const char* getStatusStr(ClientStatus code)
+        worker.thread = std::thread(runWorker, &worker);
+        ++numWorkers;
+
+        // cpu 0 is left for the network thread
+        if(pin && numCpus > 1)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(1 + i % (numCpus - 1), &cpus);
+
+            const int ec = pthread_setaffinity_np(worker.thread.native_handle(), sizeof(cpus),
+                                                  &cpus);
+            if(ec != 0)
+                printf("pthread_setaffinity_np() failed: %s\n", strerror(ec));
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldSet, nullptr);
+    return numWorkers == numWorkers_;
+}
+
+void WorkerPool::stop()
 {
-    switch(code)
+    for(int i = 0; i < numWorkers; ++i)
     {
-        case ClientStatus::WaitingForInit: return "WaitingForInit";
-        case ClientStatus::Browser: return "Browser";
-        case ClientStatus::InGame:  return "InGame";
-        case ClientStatus::Lobby: return "Lobby";
+        workers[i].exit = true;
+        notify(workers[i].wakefd);
     }
-    assert(false);
+
+    for(int i = 0; i < numWorkers; ++i)
+    {
+        workers[i].thread.join();
+        close(workers[i].wakefd);
+    }
+
+    numWorkers = 0;
 }
 
-bool wouldBlock()
+void WorkerPool::push(const RoomMsg& msg)
 {
-    return errno == EAGAIN || errno == EWOULDBLOCK;
+    Worker& worker = getWorker(msg.room);
+
+    while(!worker.in.push(msg))
+    {
+        receive();
+        sched_yield();
+    }
+
+    if(msg.type == RoomMsg::NewGame)
+        notify(worker.wakefd);
 }
 
-enum {MaxClients = 10};
+bool WorkerPool::tryPush(const RoomMsg& msg)
+{
+    return getWorker(msg.room).in.push(msg);
+}
 
-void sendInitTileData(FixedArray<Client, MaxClients>& clients, Array<char>* sendBufs, int* tileMap)
+void WorkerPool::receive()
 {
-    for(int cidx = 0; cidx < clients.size(); ++cidx)
+    for(int i = 0; i < numWorkers; ++i)
     {
-        if(clients[cidx].status == ClientStatus::InGame)
+        SpscByteQueue<1 << 18>& out = workers[i].out;
+
+        // records are written at once, there is no partial record
+        while(out.numReadable())
         {
-            constexpr int numTiles = Simulation::MapSize * Simulation::MapSize;
+            OutHeader header;
+            out.read(&header, sizeof(header));
+            Connection& conn = conns[header.conn];
+
+            if(header.block)
+            {
+                if(conn.sockfd != -1 && conn.token == header.token)
+                    conn.sendBuf.push(header.block);
+
+                header.block->release();
+                continue;
+            }
+
+            if(conn.sockfd == -1 || conn.token != header.token)
+            {
+                out.read(nullptr, header.size);
+                continue;
+            }
 
-            char buf[numTiles * 2]; // for each value we add one space
-            char* it = buf;
-            
-            for(int i = 0; i < numTiles; ++i)
+            RingBuffer::Span spans[2];
+            const int numSpans = conn.sendBuf.getWriteSpans(header.size, spans);
+            int numRead = 0;
+
+            for(int s = 0; s < numSpans && numRead < header.size; ++s)
             {
-                *it = tileMap[i] + 48; // converting to ascii
-                ++it;
-                *it = ' ';
-                ++it;
+                const int size = min(spans[s].size, header.size - numRead);
+                out.read(spans[s].data, size);
+                numRead += size;
             }
 
-            addMsg(sendBufs[cidx], Cmd::InitTileData, buf);
+            conn.sendBuf.commitWrite(header.size);
         }
     }
 }
@@ -100,39 +1467,51 @@ void sendInitTileData(FixedArray<Client, MaxClients>& clients, Array<char>* send
 static volatile int gExitLoop = false;
 void sigHandler(int) {gExitLoop = true;}
 
-void setNewGame(FixedArray<Client, MaxClients>& clients, const FixedArray<Bot, MaxPlayers>& bots,
-        Simulation& sim)
+// sends the players to the room worker, it restarts the simulation
+void setNewGame(const FixedArray<Client, MaxClients>& clients, const Connection* const conns,
+                const int roomIdx, Room& room, WorkerPool& pool)
 {
-    sim.players_.clear();
+    RoomMsg msg;
+    msg.type = RoomMsg::NewGame;
+    msg.room = roomIdx;
 
     for(const Client& client: clients)
     {
-        if(client.status == ClientStatus::InGame)
+        if(!client.remove && client.status == ClientStatus::InGame && client.room == roomIdx)
         {
-            sim.players_.pushBack({});
-            memcpy(sim.players_.back().name, client.name, Player::NameBufSize);
+            Member member;
+            memcpy(member.name, client.name, Player::NameBufSize);
+            member.conn = client.conn;
+            member.token = conns[client.conn].token;
+            member.protocol = client.protocol;
+            member.snapshotAck = 0;
+            member.inputSeq = 0;
+            member.lastSentTick = 0;
+            member.unackedTick = 0;
+            member.udp = conns[client.conn].udp;
+            msg.members.pushBack(member);
         }
     }
 
-    for(const Bot& bot: bots)
-    {
-        sim.players_.pushBack({});
-        memcpy(sim.players_.back().name, bot.name, Player::NameBufSize);
-    }
-
-    sim.setNewGame();
+    msg.bots = room.bots;
+    msg.mapWidth = room.mapWidth;
+    msg.mapHeight = room.mapHeight;
+    msg.seed = room.rng.next();
+    pool.push(msg);
+    room.needSetNewGame = false;
 }
 
-bool nameAvailable(const FixedArray<Client, MaxClients>& clients,
-        const FixedArray<Bot, MaxPlayers>& bots, const char* name)
+bool nameAvailable(const FixedArray<Client, MaxClients>& clients, const int roomIdx,
+        const Room& room, const char* name)
 {
     for(const Client& client: clients)
     { 
-        if(client.status == ClientStatus::InGame && strcmp(client.name, name) == 0)
+        if(client.status == ClientStatus::InGame && client.room == roomIdx &&
+           strcmp(client.name, name) == 0)
             return false;
     }
 
-    for(const Bot& bot: bots)
+    for(const Bot& bot: room.bots)
     { 
         if(strcmp(bot.name, name) == 0)
             return false;
@@ -141,16 +1520,131 @@ bool nameAvailable(const FixedArray<Client, MaxClients>& clients,
     return true;
 }
 
-int main()
+// no whitespace, otherwise our serialization system will fail :D
+bool isValidName(const char* str)
 {
-    srand(time(nullptr));
+    while(*str != '\0')
+    {
+        const char code = *str;
 
-    signal(SIGINT, sigHandler);
-    signal(SIGTERM, sigHandler);
+        if(code < 33 || code > 126)
+            return false;
+
+        ++str;
+    }
+
+    return true;
+}
+
+// returns -1 if there is no such room
+int findRoom(const Room* const rooms, const char* const name)
+{
+    for(int i = 0; i < MaxRooms; ++i)
+    {
+        if(rooms[i].active && strcmp(rooms[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+// the clients that don't know the map dimensions (see sendInitTileData()) can play only on the
+// legacy map
+bool canPlayOn(const Client& client, const Room& room)
+{
+    return client.protocol == ProtocolVersion ||
+           (room.mapWidth == Simulation::LegacyMapSize &&
+            room.mapHeight == Simulation::LegacyMapSize);
+}
 
+// returns -1 if all the rooms are taken
+int createRoom(Room* const rooms, const char* const name, const int mapWidth,
+               const int mapHeight)
+{
+    assert(Simulation::isValidMapSize(mapWidth, mapHeight));
+
+    for(int i = 0; i < MaxRooms; ++i)
+    {
+        Room& room = rooms[i];
+
+        if(room.active)
+            continue;
+
+        room.active = true;
+        snprintf(room.name, sizeof(room.name), "%s", name);
+        room.numClients = 0;
+        room.needSetNewGame = false;
+        room.bots.clear();
+        room.mapWidth = mapWidth;
+        room.mapHeight = mapHeight;
+        printf("created room %s (%dx%d)\n", room.name, mapWidth, mapHeight);
+        return i;
+    }
+
+    return -1;
+}
+
+// the rest of the room is restarted at the end of the server loop iteration
+void leaveRoom(const FixedArray<Client, MaxClients>& clients, Connection* const conns,
+               Room* const rooms, WorkerPool& pool, Client& client)
+{
+    const int roomIdx = client.room;
+    Room& room = rooms[roomIdx];
+
+    assert(room.numClients > 0);
+    client.room = -1;
+    --room.numClients;
+
+    if(room.numClients == 0)
+    {
+        printf("closing room %s\n", room.name);
+        room.active = false;
+
+        RoomMsg msg;
+        msg.type = RoomMsg::Close;
+        msg.room = roomIdx;
+        pool.push(msg);
+        return;
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s has left", client.name);
+    addMsgToRoom(clients, conns, roomIdx, Cmd::Chat, buf);
+    room.needSetNewGame = true;
+}
+
+// client must be InGame; the caller checks if the room is not full and if the name is available
+void joinRoom(const FixedArray<Client, MaxClients>& clients, Connection* const conns,
+              Room* const rooms, WorkerPool& pool, Client& client, const int roomIdx)
+{
+    if(client.room != -1)
+        leaveRoom(clients, conns, rooms, pool, client);
+
+    Room& room = rooms[roomIdx];
+    client.room = roomIdx;
+    ++room.numClients;
+
+    // drop the messages that the previous room worker has not delivered yet; its snapshots
+    // can't be used as the baseline (the client clears its snapshots on Cmd::JoinRoom)
+    ++conns[client.conn].token;
+
+    // old clients don't know about the rooms
+    if(client.protocol == ProtocolVersion)
+        addMsg(conns[client.conn].sendBuf, Cmd::JoinRoom, room.name);
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s has joined the game!", client.name);
+    addMsgToRoom(clients, conns, roomIdx, Cmd::Chat, buf);
+
+    setNewGame(clients, conns, roomIdx, room, pool);
+}
+
+// the non-blocking server socket (SOCK_STREAM or SOCK_DGRAM) bound to the port, -1 on failure
+static int bindSocket(const int socktype)
+{
     addrinfo hints = {};
     hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_socktype = socktype;
     hints.ai_flags = AI_PASSIVE;
 
     addrinfo* list;
@@ -160,14 +1654,13 @@ int main()
         if(ec != 0)
         {
             printf("getaddrinfo() failed: %s\n", gai_strerror(ec));
-            return 0;
+            return -1;
         }
     }
 
-    int sockfd;
+    int sockfd = -1;
 
-    const addrinfo* it;
-    for(it = list; it != nullptr; it = it->ai_next)
+    for(const addrinfo* it = list; it != nullptr; it = it->ai_next)
     {
         sockfd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
         if(sockfd == -1)
@@ -180,20 +1673,23 @@ int main()
         if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option)) == -1)
         {
             close(sockfd);
+            sockfd = -1;
             perror("setsockopt() (SO_REUSEADDR) failed");
-            return 0;
+            break;
         }
 
         if(fcntl(sockfd, F_SETFL, O_NONBLOCK) == -1)
         {
             close(sockfd);
+            sockfd = -1;
             perror("fcntl() failed");
-            return 0;
+            break;
         }
 
         if(bind(sockfd, it->ai_addr, it->ai_addrlen) == -1)
         {
             close(sockfd);
+            sockfd = -1;
             perror("bind() failed");
             continue;
         }
@@ -202,12 +1698,96 @@ int main()
     }
     freeaddrinfo(list);
 
-    if(it == nullptr)
-    {
+    if(sockfd == -1)
         printf("binding procedure failed\n");
-        return 0;
+
+    return sockfd;
+}
+
+void printUsage()
+{
+    printf("usage: server [options]\n"
+           "  --workers <n>           simulation threads (default: number of cpus - 1)\n"
+           "  --pin-workers           bind each worker to its own cpu\n"
+           "  --tick-rate <hz>        simulation steps per second (default 120)\n"
+           "  --send-rate <hz>        snapshots per second sent to a client, rounded to a\n"
+           "                          whole number of steps (default 60)\n"
+           "  --max-catch-up <steps>  max steps per wake up when falling behind (default 8)\n"
+           "  --map-size <w>x<h>      map of the rooms created without the size, odd values\n"
+           "                          in [%d, %d] (default 13x13)\n"
+           "  --seed <n>              seed of the crate layouts (default: time)\n"
+           "  --record <path>         save the matches to <path>.<room index> (see replay)\n"
+           "  --net-sim <conditions>  simulate a bad network on the sent data (testing),\n"
+           "                          latency=80,jitter=20,bandwidth=64,loss=2,reorder=1,\n"
+           "                          seed=7 (ms, ms, kB/s, %%, %%), any subset\n",
+           int(Simulation::MinMapSize), int(Simulation::MaxMapSize));
+}
+
+int main(int argc, char** argv)
+{
+    FixedStep fixedStep;
+    int sendRate = 60;
+    int numWorkers = max(1, int(std::thread::hardware_concurrency()) - 1);
+    bool pinWorkers = false;
+    int mapWidth = Simulation::LegacyMapSize;
+    int mapHeight = Simulation::LegacyMapSize;
+    unsigned long long seed = time(nullptr);
+    const char* recordPath = nullptr;
+    NetConditions netConditions;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        const bool hasValue = i + 1 < argc;
+
+        if(hasValue && strcmp(argv[i], "--workers") == 0)
+            numWorkers = atoi(argv[++i]);
+
+        else if(strcmp(argv[i], "--pin-workers") == 0)
+            pinWorkers = true;
+
+        else if(hasValue && strcmp(argv[i], "--tick-rate") == 0)
+            fixedStep.stepDt = 1.f / max(1, atoi(argv[++i]));
+
+        else if(hasValue && strcmp(argv[i], "--send-rate") == 0)
+            sendRate = max(1, atoi(argv[++i]));
+
+        else if(hasValue && strcmp(argv[i], "--max-catch-up") == 0)
+            fixedStep.maxCatchUpSteps = max(1, atoi(argv[++i]));
+
+        else if(hasValue && strcmp(argv[i], "--map-size") == 0 &&
+                sscanf(argv[i + 1], "%dx%d", &mapWidth, &mapHeight) == 2 &&
+                Simulation::isValidMapSize(mapWidth, mapHeight))
+        {
+            ++i;
+        }
+
+        else if(hasValue && strcmp(argv[i], "--seed") == 0)
+            seed = strtoull(argv[++i], nullptr, 10);
+
+        else if(hasValue && strcmp(argv[i], "--record") == 0)
+            recordPath = argv[++i];
+
+        else if(hasValue && strcmp(argv[i], "--net-sim") == 0 &&
+                parseNetConditions(argv[i + 1], netConditions))
+        {
+            ++i;
+        }
+
+        else
+        {
+            printUsage();
+            return 0;
+        }
     }
 
+    signal(SIGINT, sigHandler);
+    signal(SIGTERM, sigHandler);
+
+    const int sockfd = bindSocket(SOCK_STREAM);
+
+    if(sockfd == -1)
+        return 0;
+
     if(listen(sockfd, 5) == -1)
     {
         perror("listen() failed");
@@ -215,117 +1795,304 @@ int main()
         return 0;
     }
 
-    FixedArray<Client, MaxClients> clients;
-    Array<char> sendBufs[MaxClients];
-    Array<char> recvBufs[MaxClients];
-    int recvBufsNumUsed[MaxClients];
+    // UDP clients (see UdpLink) on the same port
+    const int udpfd = bindSocket(SOCK_DGRAM);
 
-    for(int i = 0; i < MaxClients; ++i)
+    if(udpfd == -1)
+    {
+        close(sockfd);
+        return 0;
+    }
+
+    static Reactor reactor; // too big for the stack (UdpLink per connection)
+    reactor.netConditions = netConditions;
+
+    if(!reactor.init(sockfd, udpfd))
     {
-        sendBufs[i].reserve(500);
-        recvBufs[i].resize(500);
+        reactor.shutdown();
+        close(sockfd);
+        close(udpfd);
+        return 0;
     }
 
+    Connection* const conns = reactor.conns;
+    FixedArray<Client, MaxClients> clients;
+    FixedArray<int, MaxClients> readable; // clients that received data in this iteration
+
     double currentTime = getTimeSec();
     float timer = 0.f;
 
-    Simulation sim;
-    FixedArray<ExploEvent, 50> exploEvents;
-    FixedArray<Bot, MaxPlayers> bots;
+    Room rooms[MaxRooms];
+
+    for(int i = 0; i < MaxRooms; ++i)
+        rooms[i].rng.setSeed(seed + i);
+
+    static WorkerPool pool; // too big for the stack (queues, snapshots)
+
+    numWorkers = min(max(1, numWorkers), int(MaxWorkers));
+
+    // the send rate can't be higher than the tick rate
+    const int sendInterval = max(1, int(1.f / (fixedStep.stepDt * sendRate) + 0.5f));
+
+    if(!pool.start(numWorkers, conns, reactor.notifyfd, fixedStep, sendInterval, pinWorkers,
+                   recordPath))
+    {
+        pool.stop();
+        reactor.shutdown();
+        close(sockfd);
+        close(udpfd);
+        return 0;
+    }
+
+    printf("started %d workers, %.0f ticks per second, snapshots every %d ticks\n", numWorkers,
+           1.f / fixedStep.stepDt, sendInterval);
+
+    if(netConditions.isActive())
+    {
+        printf("simulating the network: latency %.0f ms, jitter %.0f ms, bandwidth %d B/s, "
+               "loss %.1f%%, reorder %.1f%%, seed %u\n", netConditions.latency * 1000.f,
+               netConditions.jitter * 1000.f, netConditions.bandwidth,
+               netConditions.loss * 100.f, netConditions.reorder * 100.f, netConditions.seed);
+    }
+
+    // the simulation runs on the workers, the timer only drives the PING / alive checks (and the
+    // UDP resends and the NetShim, see UdpTimerInterval)
+    reactor.setTimer(1.0);
 
     // server loop
     // note: don't change the order of operations
     // (some logic is based on this)
     while(gExitLoop == false)
     {
+        epoll_event events[MaxClients + 4];
+        const int numEvents = epoll_wait(reactor.epollfd, events, getSize(events), -1);
+
+        if(numEvents == -1)
+        {
+            // signal
+            if(errno != EINTR)
+                perror("epoll_wait() failed");
+
+            continue;
+        }
+
         const double newTime = getTimeSec();
         const double dt = newTime - currentTime;
         timer += dt;
         currentTime = newTime;
 
-        // update clients
+        readable.clear();
+
+        for(int eventIdx = 0; eventIdx < numEvents; ++eventIdx)
         {
-            if(timer > 5.f)
+            const epoll_event& event = events[eventIdx];
+
+            if(event.data.u32 == TimerToken)
             {
-                timer = 0.f;
+                reactor.readTimer();
+                continue;
+            }
 
-                for(int i = 0; i < clients.size(); ++i)
+            // the worker messages are received every iteration
+            if(event.data.u32 == NotifyToken)
+            {
+                reactor.readNotify();
+                continue;
+            }
+
+            // handle new clients
+            if(event.data.u32 == ListenToken)
+            {
+                while(clients.size() < clients.maxSize())
                 {
-                    Client& client = clients[i];
+                    sockaddr_storage clientAddr;
+                    socklen_t clientAddrSize = sizeof(clientAddr);
+                    const int clientSockfd = accept(sockfd, (sockaddr*)&clientAddr,
+                                                    &clientAddrSize);
 
-                    if(client.alive == false)
+                    if(clientSockfd == -1)
                     {
-                        printf("client %s (%s) will be removed (no PONG or init msg)\n",
-                               client.name, getStatusStr(client.status));
-                        client.remove = true;
+                        // this can't be combined with the parent if
+                        if(!wouldBlock())
+                            perror("accept()");
+
+                        break;
                     }
-                    else if(client.status != ClientStatus::WaitingForInit)
-                        addMsg(sendBufs[i], Cmd::Ping);
 
-                    client.alive = false;
-                }
-            }
-        }
+                    const int option = 1;
 
-        // handle new client
-        if(clients.size() < clients.maxSize())
-        {
-            sockaddr_storage clientAddr;
-            socklen_t clientAddrSize = sizeof(clientAddr);
-            const int clientSockfd = accept(sockfd, (sockaddr*)&clientAddr, &clientAddrSize);
+                    if(fcntl(clientSockfd, F_SETFL, O_NONBLOCK) == -1)
+                    {
+                        close(clientSockfd);
+                        perror("fcntl() on client failed");
+                        continue;
+                    }
 
-            if(clientSockfd == -1)
-            {
-                // this can't be combined with the parent if
-                if(!wouldBlock())
-                {
-                    perror("accept()");
-                    assert(false);
+                    if(setsockopt(clientSockfd, IPPROTO_TCP, TCP_NODELAY, &option,
+                                  sizeof(option)) == -1)
+                    {
+                        close(clientSockfd);
+                        perror("setsockopt() (TCP_NODELAY) on client failed");
+                        continue;
+                    }
+
+                    const int conn = reactor.addConnection(clientSockfd, clients.size());
+
+                    if(conn == -1)
+                    {
+                        close(clientSockfd);
+                        continue;
+                    }
+
+                    clients.pushBack(Client());
+                    clients.back().conn = conn;
+
+                    // print client ip
+                    char ipStr[INET6_ADDRSTRLEN];
+                    inet_ntop(clientAddr.ss_family, get_in_addr( (sockaddr*)&clientAddr ),
+                              ipStr, sizeof(ipStr));
+                    printf("accepted connection from %s\n", ipStr);
                 }
+
+                // pending connections will wait in the backlog
+                if(clients.size() == clients.maxSize())
+                    reactor.setListening(false);
+
+                continue;
             }
-            else
+
+            // every UDP client, a connect packet with an unknown connection id starts a new
+            // connection (see UdpChallengeMagic)
+            if(event.data.u32 == UdpToken)
             {
-                const int option = 1;
+                Array<char>& packet = reactor.udpRecvBuf;
+
+                while(true)
+                {
+                    sockaddr_storage addr;
+                    socklen_t addrLen = sizeof(addr);
+                    const int size = recvfrom(reactor.udpfd, packet.data(), packet.size(), 0,
+                                              (sockaddr*)&addr, &addrLen);
+
+                    if(size == -1)
+                    {
+                        if(!wouldBlock())
+                            perror("recvfrom() failed");
+
+                        break;
+                    }
+
+                    const unsigned id = getUdpConnectionId(packet.data(), size);
+
+                    if(!id)
+                        continue;
+
+                    int connIdx = reactor.findUdpConnection(id);
+
+                    if(connIdx == -1)
+                    {
+                        // the stale packets of a removed connection don't start with
+                        // Cmd::Protocol
+                        if(clients.size() == clients.maxSize() ||
+                           !isUdpConnectPacket(packet.data(), size))
+                        {
+                            continue;
+                        }
+
+                        // the cookie proves the client receives at the source address; the
+                        // challenge is smaller than the connect packet (no amplification)
+                        const unsigned cookie = reactor.getUdpCookie(id);
+
+                        if(getUdpPacketCookie(packet.data(), size) != cookie)
+                        {
+                            const int challengeSize = buildUdpChallenge(reactor.udpPacket, id,
+                                                                        cookie);
+
+                            if(sendto(reactor.udpfd, reactor.udpPacket.data(), challengeSize, 0,
+                                      (sockaddr*)&addr, addrLen) == -1 && !wouldBlock())
+                            {
+                                perror("sendto() failed");
+                            }
+
+                            continue;
+                        }
+
+                        connIdx = reactor.addUdpConnection(id, cookie, clients.size());
+
+                        if(connIdx == -1)
+                            continue;
+
+                        clients.pushBack(Client());
+                        clients.back().conn = connIdx;
+
+                        char ipStr[INET6_ADDRSTRLEN];
+                        inet_ntop(addr.ss_family, get_in_addr( (sockaddr*)&addr ), ipStr,
+                                  sizeof(ipStr));
+                        printf("accepted UDP connection from %s\n", ipStr);
+                    }
+
+                    Connection& conn = conns[connIdx];
+                    Client& client = clients[conn.clientIdx];
+
+                    if(client.remove)
+                        continue;
+
+                    // like the TCP recvBuf limit, the client is not reading what it sends
+                    if(conn.recvBufNumUsed + size > MaxRecvBufSize)
+                    {
+                        printf("recvBuf BIG SIZE ISSUE, removing %s (%s)\n", client.name,
+                               getStatusStr(client.status));
+
+                        client.remove = true;
+                        continue;
+                    }
+
+                    if(!conn.link.receive(packet.data(), size, currentTime, conn.recvBuf,
+                                          conn.recvBufNumUsed))
+                    {
+                        continue;
+                    }
+
+                    // only an accepted packet (not a malformed, duplicate or old one) can move
+                    // the connection to another address
+                    conn.addr = addr;
+                    conn.addrLen = addrLen;
+
+                    bool isReadable = false;
+
+                    for(const int idx: readable)
+                        isReadable = isReadable || idx == conn.clientIdx;
 
-                if(fcntl(clientSockfd, F_SETFL, O_NONBLOCK) == -1)
-                {
-                    close(clientSockfd);
-                    perror("fcntl() on client failed");
-                }
-                else if(setsockopt(clientSockfd, IPPROTO_TCP, TCP_NODELAY, &option,
-                                   sizeof(option)) == -1)
-                {
-                    close(clientSockfd);
-                    perror("setsockopt() (TCP_NODELAY) on client failed");
+                    if(!isReadable)
+                        readable.pushBack(conn.clientIdx);
                 }
-                else
-                {
-                    clients.pushBack(Client());
-                    clients.back().sockfd = clientSockfd;
-                    sendBufs[clients.size() - 1].clear();
-                    recvBufsNumUsed[clients.size() - 1] = 0;
 
-                    // print client ip
-                    char ipStr[INET6_ADDRSTRLEN];
-                    inet_ntop(clientAddr.ss_family, get_in_addr( (sockaddr*)&clientAddr ),
-                              ipStr, sizeof(ipStr));
-                    printf("accepted connection from %s\n", ipStr);
-                }
+                if(clients.size() == clients.maxSize())
+                    reactor.setListening(false);
 
+                continue;
             }
-        }
 
-        // receive
-        for(int i = 0; i < clients.size(); ++i)
-        {
-            Array<char>& recvBuf = recvBufs[i];
-            int& recvBufNumUsed = recvBufsNumUsed[i];
-            Client& client = clients[i];
+            Connection& conn = conns[event.data.u32];
+            Client& client = clients[conn.clientIdx];
+
+            if(event.events & EPOLLOUT)
+            {
+                if(!reactor.flush(event.data.u32))
+                    client.remove = true;
+            }
+
+            if( !(event.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) )
+                continue;
+
+            // receive
+            Array<char>& recvBuf = conn.recvBuf;
+            int& recvBufNumUsed = conn.recvBufNumUsed;
 
             while(true)
             {
                 const int numFree = recvBuf.size() - recvBufNumUsed;
-                const int rc = recv(client.sockfd, recvBuf.data() + recvBufNumUsed,
+                const int rc = recv(conn.sockfd, recvBuf.data() + recvBufNumUsed,
                                     numFree, 0);
 
                 if(rc == -1)
@@ -355,7 +2122,7 @@ int main()
 
                     recvBuf.resize(recvBuf.size() * 2);
 
-                    if(recvBuf.size() > 10000)
+                    if(recvBuf.size() > MaxRecvBufSize)
                     {
                         printf("recvBuf BIG SIZE ISSUE, clearing the buffer for %s (%s)\n",
                                 client.name, getStatusStr(client.status));
@@ -364,18 +2131,45 @@ int main()
                     }
                 }
             }
+
+            readable.pushBack(conn.clientIdx);
+        }
+
+        // update clients
+        {
+            if(timer > 5.f)
+            {
+                timer = 0.f;
+
+                for(int i = 0; i < clients.size(); ++i)
+                {
+                    Client& client = clients[i];
+
+                    if(client.alive == false)
+                    {
+                        printf("client %s (%s) will be removed (no PONG or init msg)\n",
+                               client.name, getStatusStr(client.status));
+                        client.remove = true;
+                    }
+                    else if(client.status != ClientStatus::WaitingForInit)
+                        addMsg(conns[client.conn].sendBuf, Cmd::Ping);
+
+                    client.alive = false;
+                }
+            }
         }
 
         // process received data
-        for(int i = 0; i < clients.size(); ++i)
+        for(const int i: readable)
         {
-            Array<char>& sendBuf = sendBufs[i];
-            Array<char>& recvBuf = recvBufs[i];
-            int& recvBufNumUsed = recvBufsNumUsed[i];
+            Connection& conn = conns[clients[i].conn];
+            SendQueue& sendBuf = conn.sendBuf;
+            Array<char>& recvBuf = conn.recvBuf;
+            int& recvBufNumUsed = conn.recvBufNumUsed;
             Client& thisClient = clients[i];
 
-            const char* end = recvBuf.data();
-            const char* begin;
+            const char* it = recvBuf.data();
+            const char* const bufEnd = recvBuf.data() + recvBufNumUsed;
 
             // special case for http
             if(recvBufNumUsed >= 3)
@@ -400,32 +2194,25 @@ int main()
 
             while(true)
             {
-                begin = end;
+                Msg msg;
                 {
-                    const char* tmp = (const char*)memchr((const void*)end, '\0',
-                                       recvBuf.data() + recvBufNumUsed - end);
+                    const int numBytes = parseMsg(it, bufEnd - it, msg);
 
-                    if(tmp == nullptr) break;
-                    end = tmp;
+                    if(numBytes == 0) break;
+                    it += numBytes;
                 }
 
-                ++end;
+                const int cmd = msg.cmd;
+                const char* const begin = msg.payload;
 
-                int cmd = 0;
-                for(int i = 1; i < Cmd::_count; ++i)
+                // protocol 7 clients send the text commands binary (the opcode is read
+                // directly), the payload must be null terminated
+                if(msg.binary && cmd != Cmd::PlayerInput &&
+                   (msg.size == 0 || begin[msg.size - 1] != '\0'))
                 {
-                    const char* const cmdStr = getCmdStr(i);
-                    const int cmdLen = strlen(cmdStr);
-
-                    if(cmdLen > int(strlen(begin)))
-                        continue;
-
-                    if(strncmp(begin, cmdStr, cmdLen) == 0)
-                    {
-                        cmd = i;
-                        begin += cmdLen + 1; // ' '
-                        break;
-                    }
+                    printf("%s (%s) WARNING malformed binary message (cmd %d)\n",
+                            thisClient.name, getStatusStr(thisClient.status), cmd);
+                    continue;
                 }
 
                 switch(cmd)
@@ -443,95 +2230,244 @@ int main()
                         thisClient.alive = true;
                         break;
 
+                    case Cmd::Protocol:
+                    {
+                        // unknown versions fall back to the text protocol
+                        thisClient.protocol = atoi(begin) == ProtocolVersion ? ProtocolVersion
+                                                                             : 0;
+                        char buf[16];
+                        snprintf(buf, sizeof(buf), "%d", thisClient.protocol);
+                        addMsg(sendBuf, Cmd::Protocol, buf);
+                        break;
+                    }
+
+                    case Cmd::SnapshotAck:
+                    {
+                        if(thisClient.status != ClientStatus::InGame)
+                            break;
+
+                        // 0 requests a full snapshot
+                        RoomMsg msg;
+                        msg.type = RoomMsg::Ack;
+                        msg.room = thisClient.room;
+                        msg.conn = thisClient.conn;
+                        msg.token = conn.token;
+                        msg.tick = atoi(begin);
+
+                        // a lost ack only makes the next deltas bigger
+                        pool.tryPush(msg);
+                        break;
+                    }
+
                     case Cmd::SetName:
                     {
-                        // validate if there is no whitespace
-                        // otherwise our serialization system will fail :D
+                        if(!isValidName(begin))
                         {
-                            bool valid = true;
-                            const char* str = begin;
-                            while(*str != '\0')
-                            {
-                                const char code = *str;
+                            addMsg(sendBuf, Cmd::MustRename, begin);
+                            break;
+                        }
 
-                                if(code < 33 || code > 126)
-                                {
-                                    valid = false;
-                                    break;
-                                }
+                        // rename
+                        if(thisClient.status == ClientStatus::InGame)
+                        {
+                            // case when in-game client sets the same name once again
+                            if(strcmp(thisClient.name, begin) == 0)
+                                break;
 
-                                ++str;
-                            }
+                            const int roomIdx = thisClient.room;
+                            Room& room = rooms[roomIdx];
 
-                            if(!valid)
+                            if(!nameAvailable(clients, roomIdx, room, begin))
                             {
                                 addMsg(sendBuf, Cmd::MustRename, begin);
                                 break;
                             }
+
+                            char oldName[Player::NameBufSize];
+                            memcpy(oldName, thisClient.name, Player::NameBufSize);
+                            memcpy(thisClient.name, begin, Player::NameBufSize);
+                            thisClient.name[Player::NameBufSize - 1] = '\0';
+                            addMsg(sendBuf, Cmd::NameOk, thisClient.name);
+
+                            char msg[128];
+                            snprintf(msg, sizeof(msg), "%s changed name to %s!", oldName,
+                                     thisClient.name);
+
+                            addMsgToRoom(clients, conns, roomIdx, Cmd::Chat, msg);
+                            setNewGame(clients, conns, roomIdx, room, pool);
+                            break;
                         }
 
-                        const bool isInGame = thisClient.status == ClientStatus::InGame;
+                        thisClient.status = ClientStatus::Lobby;
+
+                        // join the first room with a free slot, create a new one if there is
+                        // no such room; clients can switch the room later (Cmd::JoinRoom)
+                        int roomIdx = -1;
 
-                        // case when in-game client sets the same name once again
-                        if(isInGame)
+                        for(int r = 0; r < MaxRooms; ++r)
                         {
-                            if(strcmp(thisClient.name, begin) == 0)
+                            if(rooms[r].active && !rooms[r].isFull() &&
+                               canPlayOn(thisClient, rooms[r]) &&
+                               nameAvailable(clients, r, rooms[r], begin))
+                            {
+                                roomIdx = r;
                                 break;
+                            }
                         }
 
-                        if(!isInGame)
-                            thisClient.status = ClientStatus::Lobby;
-
-                        if(!isInGame)
+                        if(roomIdx == -1)
                         {
-                            if(sim.players_.size() == sim.players_.maxSize())
+                            char roomName[RoomNameBufSize];
+
+                            for(int n = 0; ; ++n)
                             {
-                                addMsg(sendBuf, Cmd::GameFull);
-                                break;
+                                snprintf(roomName, sizeof(roomName), "room_%d", n);
+
+                                if(findRoom(rooms, roomName) == -1)
+                                    break;
+                            }
+
+                            if(thisClient.protocol == ProtocolVersion)
+                                roomIdx = createRoom(rooms, roomName, mapWidth, mapHeight);
+                            else
+                            {
+                                roomIdx = createRoom(rooms, roomName, Simulation::LegacyMapSize,
+                                                     Simulation::LegacyMapSize);
                             }
                         }
 
-                        if(!nameAvailable(clients, bots, begin))
+                        if(roomIdx == -1)
                         {
-                            addMsg(sendBuf, Cmd::MustRename, begin);
+                            addMsg(sendBuf, Cmd::GameFull);
+                            break;
+                        }
+
+                        thisClient.status = ClientStatus::InGame;
+                        memcpy(thisClient.name, begin, Player::NameBufSize);
+                        thisClient.name[Player::NameBufSize - 1] = '\0';
+                        addMsg(sendBuf, Cmd::NameOk, thisClient.name);
+                        joinRoom(clients, conns, rooms, pool, thisClient, roomIdx);
+                        break;
+                    }
+
+                    case Cmd::CreateRoom:
+                    {
+                        if(thisClient.status != ClientStatus::InGame)
+                        {
+                            addMsg(sendBuf, Cmd::RoomError, "set the name first");
                             break;
                         }
 
-                        bool rename = false;
-                        char oldName[Player::NameBufSize];
+                        // "name [width height]", the map dimensions are optional
+                        const char* const space = strchr(begin, ' ');
+                        const int len = space ? space - begin : strlen(begin);
+                        char roomName[RoomNameBufSize];
 
-                        if(isInGame)
+                        if(len == 0 || len >= RoomNameBufSize)
                         {
-                            rename = true;
-                            memcpy(oldName, thisClient.name, Player::NameBufSize);
+                            addMsg(sendBuf, Cmd::RoomError, "invalid room name");
+                            break;
+                        }
+
+                        memcpy(roomName, begin, len);
+                        roomName[len] = '\0';
+
+                        if(!isValidName(roomName))
+                        {
+                            addMsg(sendBuf, Cmd::RoomError, "invalid room name");
+                            break;
+                        }
+
+                        int roomMapWidth = mapWidth;
+                        int roomMapHeight = mapHeight;
+
+                        if(thisClient.protocol != ProtocolVersion)
+                        {
+                            roomMapWidth = Simulation::LegacyMapSize;
+                            roomMapHeight = Simulation::LegacyMapSize;
+                        }
+                        else if(space && (sscanf(space, "%d %d", &roomMapWidth,
+                                                 &roomMapHeight) != 2 ||
+                                          !Simulation::isValidMapSize(roomMapWidth,
+                                                                      roomMapHeight)))
+                        {
+                            addMsg(sendBuf, Cmd::RoomError, "invalid map size");
+                            break;
+                        }
+
+                        if(findRoom(rooms, roomName) != -1)
+                        {
+                            addMsg(sendBuf, Cmd::RoomError, "room already exists");
+                            break;
+                        }
+
+                        const int roomIdx = createRoom(rooms, roomName, roomMapWidth,
+                                                       roomMapHeight);
+
+                        if(roomIdx == -1)
+                        {
+                            addMsg(sendBuf, Cmd::RoomError, "no free rooms");
+                            break;
+                        }
+
+                        joinRoom(clients, conns, rooms, pool, thisClient, roomIdx);
+                        break;
+                    }
+
+                    case Cmd::JoinRoom:
+                    {
+                        if(thisClient.status != ClientStatus::InGame)
+                        {
+                            addMsg(sendBuf, Cmd::RoomError, "set the name first");
+                            break;
                         }
+
+                        const int roomIdx = findRoom(rooms, begin);
+
+                        if(roomIdx == -1)
+                            addMsg(sendBuf, Cmd::RoomError, "room does not exist");
+
+                        else if(roomIdx == thisClient.room)
+                            addMsg(sendBuf, Cmd::JoinRoom, rooms[roomIdx].name);
+
+                        else if(rooms[roomIdx].isFull())
+                            addMsg(sendBuf, Cmd::RoomError, "room is full");
+
+                        else if(!canPlayOn(thisClient, rooms[roomIdx]))
+                            addMsg(sendBuf, Cmd::RoomError, "map size not supported");
+
+                        else if(!nameAvailable(clients, roomIdx, rooms[roomIdx], thisClient.name))
+                            addMsg(sendBuf, Cmd::RoomError, "name is taken in this room");
+
                         else
-                            thisClient.status = ClientStatus::InGame;
+                            joinRoom(clients, conns, rooms, pool, thisClient, roomIdx);
 
-                        memcpy(thisClient.name, begin, Player::NameBufSize);
-                        thisClient.name[Player::NameBufSize - 1] = '\0';
-                        addMsg(sendBuf, Cmd::NameOk, thisClient.name);
+                        break;
+                    }
+
+                    case Cmd::ListRooms:
+                    {
+                        char buf[MaxRooms * (RoomNameBufSize + 12)];
+                        int offset = 0;
+                        buf[0] = '\0';
 
-                        // send announcement
-                        for(int i = 0; i < clients.size(); ++i)
+                        for(const Room& room: rooms)
                         {
-                            if(clients[i].status == ClientStatus::InGame)
-                            {
-                                char msg[128];
+                            if(!room.active)
+                                continue;
 
-                                if(!rename)
-                                    snprintf(msg, sizeof(msg), "%s has joined the game!",
-                                             thisClient.name);
-                                else
-                                    snprintf(msg, sizeof(msg), "%s changed name to %s!",
-                                             oldName, thisClient.name);
+                            offset += sprintf(buf + offset, "%s %d ", room.name,
+                                              room.numClients + room.bots.size());
 
-                                addMsg(sendBufs[i], Cmd::Chat, msg);
+                            if(thisClient.protocol == ProtocolVersion)
+                            {
+                                offset += sprintf(buf + offset, "%d %d ", room.mapWidth,
+                                                  room.mapHeight);
                             }
                         }
 
-                        setNewGame(clients, bots, sim);
-                        sendInitTileData(clients, sendBufs, sim.tiles_[0]);
+                        assert(offset < int(sizeof(buf)));
+                        addMsg(sendBuf, Cmd::RoomList, buf);
                         break;
                     }
 
@@ -544,34 +2480,86 @@ int main()
                             break;
                         }
 
-                        for(int i = 0; i < clients.size(); ++i)
-                        {
-                            if(clients[i].status == ClientStatus::InGame)
-                            {
-                                char msg[512];
-                                snprintf(msg, sizeof(msg), "%s: %s", thisClient.name, begin);
-                                addMsg(sendBufs[i], Cmd::Chat, msg);
-                            }
-                        }
+                        char msg[512];
+                        snprintf(msg, sizeof(msg), "%s: %s", thisClient.name, begin);
+                        addMsgToRoom(clients, conns, thisClient.room, Cmd::Chat, msg);
                         break;
                     }
 
                     case Cmd::PlayerInput:
                     {
-                        Action action;
+                        if(thisClient.status != ClientStatus::InGame)
+                            break;
 
-                        // @TODO remove this assert...
-                        assert(sscanf(begin, "%d %d %d %d %d", &action.up, &action.down,
-                                    &action.left, &action.right, &action.drop) == 5);
+                        RoomMsg input;
+                        input.type = RoomMsg::Input;
+                        input.room = thisClient.room;
+                        memcpy(input.name, thisClient.name, Player::NameBufSize);
+
+                        if(!msg.binary)
+                        {
+                            input.inputSeq = 0; // protocol 6
+
+                            if(sscanf(begin, "%d %d %d %d %d %u", &input.action.up,
+                                      &input.action.down, &input.action.left, &input.action.right,
+                                      &input.action.drop, &input.inputSeq) < 5)
+                            {
+                                printf("WARNING malformed %s from %s\n", getCmdStr(cmd),
+                                       thisClient.name);
+                                break;
+                            }
+
+                            if(!pool.tryPush(input))
+                                printf("WARNING worker queue is full, dropping %s input\n",
+                                       thisClient.name);
+                            break;
+                        }
+
+                        unsigned seq;
+                        FixedArray<Action, InputRedundancy> actions;
+
+                        if(!decodePlayerInput(begin, msg.size, seq, actions))
+                        {
+                            printf("WARNING malformed %s from %s\n", getCmdStr(cmd),
+                                   thisClient.name);
+                            break;
+                        }
+
+                        // only the inputs not seen yet, in order (the older ones are repeats)
+                        for(int i = 0; i < actions.size(); ++i)
+                        {
+                            const unsigned inputSeq = seq - (actions.size() - 1 - i);
+
+                            if(int(inputSeq - thisClient.inputSeq) <= 0)
+                                continue;
+
+                            input.action = actions[i];
+                            input.inputSeq = inputSeq;
+
+                            // the rest is taken from the next packet (it repeats them)
+                            if(!pool.tryPush(input))
+                            {
+                                printf("WARNING worker queue is full, deferring %s inputs\n",
+                                       thisClient.name);
+                                break;
+                            }
+
+                            thisClient.inputSeq = inputSeq;
+                        }
 
-                        sim.processPlayerInput(action, thisClient.name);
                         break;
                     }
 
                     // @TODO send operation status to clients
                     case Cmd::AddBot:
                     {
-                        if(sim.players_.size() == sim.players_.maxSize())
+                        if(thisClient.status != ClientStatus::InGame)
+                            break;
+
+                        const int roomIdx = thisClient.room;
+                        Room& room = rooms[roomIdx];
+
+                        if(room.isFull())
                             break;
 
                         Bot bot;
@@ -580,11 +2568,10 @@ int main()
                         {
                             snprintf(bot.name, sizeof(bot.name), "bot_%d", idx++);
 
-                            if(nameAvailable(clients, bots, bot.name))
+                            if(nameAvailable(clients, roomIdx, room, bot.name))
                             {
-                                bots.pushBack(bot);
-                                setNewGame(clients, bots, sim);
-                                sendInitTileData(clients, sendBufs, sim.tiles_[0]);
+                                room.bots.pushBack(bot);
+                                setNewGame(clients, conns, roomIdx, room, pool);
                                 break;
                             }
                         }
@@ -595,11 +2582,16 @@ int main()
                     // @TODO send operation status to clients
                     case Cmd::RemoveBot:
                     {
-                        if(bots.size())
+                        if(thisClient.status != ClientStatus::InGame)
+                            break;
+
+                        const int roomIdx = thisClient.room;
+                        Room& room = rooms[roomIdx];
+
+                        if(room.bots.size())
                         {
-                            bots.popBack();
-                            setNewGame(clients, bots, sim);
-                            sendInitTileData(clients, sendBufs, sim.tiles_[0]);
+                            room.bots.popBack();
+                            setNewGame(clients, conns, roomIdx, room, pool);
                         }
 
                         break;
@@ -607,124 +2599,36 @@ int main()
                 }
             }
 
-            const int numToFree = end - recvBuf.data();
+            const int numToFree = it - recvBuf.data();
             memmove(recvBuf.data(), recvBuf.data() + numToFree, recvBufNumUsed - numToFree);
             recvBufNumUsed -= numToFree;
         }
 
-        // run the simulation
-        {
-            // we check clients and not sim.players_ because we don't want to update simulation
-            // if only bots are playing
-
-            bool doSim = false;
-            for(const Client& client: clients)
-            {
-                if(client.status == ClientStatus::InGame)
-                {
-                    doSim = true;
-                    break;
-                }
-            }
-
-            if(doSim)
-            {
-                exploEvents.clear();
-
-                for(const Bot& bot: bots)
-                    sim.updateAndProcessBotInput(bot.name, dt);
-
-                if(sim.update(dt, exploEvents))
-                {
-                    sendInitTileData(clients, sendBufs, sim.tiles_[0]);
-                }
-
-                // protocol:
-                // - time to start
-                // - num players
-                // - data for each player (name must not contain any white characters)
-                // - num bombs
-                // - data for each bomb
-                // - num explo events
-                // - data for each explo event
-                // 
-                // client can update the tiles based on exploEvents
-
-                char buf[2048]; // hope it is enough :DDD
-                int offset = 0;
-
-                const int numPlayers = sim.players_.size();
-
-                offset += sprintf(buf, "%f %d ", sim.timeToStart_, numPlayers);
-
-
-                for(int i = 0; i < numPlayers; ++i)
-                {
-                    const Player& p = sim.players_[i];
-                    offset += sprintf(buf + offset, "%f %f %f %d %f %d %d %s %f %d ",
-                            p.pos.x, p.pos.y, p.vel, p.dir, p.dropCooldown, p.hp, p.score,
-                            p.name, p.dmgTimer, p.prevDir);
-                }
-
-                offset += sprintf(buf + offset, "%d ", sim.bombs_.size());
-
-                for(const Bomb& b: sim.bombs_)
-                {
-                    offset += sprintf(buf + offset, "%d %d %d %f %d %d ",
-                            b.tile.x, b.tile.y, b.range, b.timer, b.playerIdxs[0],
-                            b.playerIdxs[1]);
-                }
-
-                offset += sprintf(buf + offset, "%d ", exploEvents.size());
-
-                for(const ExploEvent& e: exploEvents)
-                {
-                    offset += sprintf(buf + offset, "%d %d %d ", e.tile.x, e.tile.y, e.type);
-                }
-
-                const int numBytes = offset + 1; // null char
-                int percentOccupied = int(float(numBytes) / sizeof(buf) * 100.f);
-
-                if(percentOccupied > 50)
-                {
-                    printf("SIMULATION: %d bytes used (%d%%), %d available\n", numBytes,
-                            percentOccupied, int(sizeof(buf)));
-                }
-
-                for(int i = 0; i < clients.size(); ++i)
-                {
-                    if(clients[i].status == ClientStatus::InGame)
-                        addMsg(sendBufs[i], Cmd::Simulation, buf);
-                }
-            }
-        }
+        // messages from the workers (simulation)
+        pool.receive();
 
         // send
+        bool hasUdp = false;
+
         for(int i = 0; i < clients.size(); ++i)
         {
             if(clients[i].remove)
                 continue;
 
-            Array<char>& buf = sendBufs[i];
-            if(buf.size())
-            {
-                const int rc = send(clients[i].sockfd, buf.data(), buf.size(), 0);
+            const Connection& conn = conns[clients[i].conn];
+            hasUdp = hasUdp || conn.udp;
 
-                if(rc == -1)
-                {
-                    // this can't be combined with the parent if
-                    if(!wouldBlock())
-                    {
-                        perror("send() failed");
-                        clients[i].remove = true;
-                    }
-                }
-                else
-                    buf.erase(0, rc);
+            if((conn.sendBuf.size() || conn.udp || !conn.shim.empty()) &&
+               !reactor.flush(clients[i].conn))
+            {
+                clients[i].remove = true;
             }
         }
 
-        bool needSetNewGame = false;
+        if(clients.size() && reactor.netConditions.isActive())
+            reactor.setTimer(NetShimTimerInterval);
+        else
+            reactor.setTimer(hasUdp ? UdpTimerInterval : 1.0);
 
         // remove some clients
         for(int cidx = 0; cidx < clients.size(); ++cidx)
@@ -734,48 +2638,33 @@ int main()
             {
                 // inform other players if someone will leave the game
                 if(client.status == ClientStatus::InGame)
-                {
-                    char buf[64];
-                    snprintf(buf, sizeof(buf), "%s has left", client.name);
-
-                    for(int i = 0; i < clients.size(); ++i)
-                    {
-                        if(!clients[i].remove && clients[i].status == ClientStatus::InGame)
-                            addMsg(sendBufs[i], Cmd::Chat, buf);
-                    }
-
-                    needSetNewGame = true;
-                }
+                    leaveRoom(clients, conns, rooms, pool, client);
 
                 printf("removing client %s (%s)\n", client.name, getStatusStr(client.status));
-                close(client.sockfd);
+                reactor.removeConnection(client.conn);
                 client = clients.back();
-
-                const int lastIdx = clients.size() - 1;
-                sendBufs[cidx].swap(sendBufs[lastIdx]);
-                recvBufs[cidx].swap(recvBufs[lastIdx]);
-                recvBufsNumUsed[cidx] = recvBufsNumUsed[lastIdx];
-
+                conns[client.conn].clientIdx = cidx;
                 clients.popBack();
+                reactor.setListening(true);
                 --cidx;
             }
         }
 
-        if(needSetNewGame)
+        for(int r = 0; r < MaxRooms; ++r)
         {
-            setNewGame(clients, bots, sim);
-            sendInitTileData(clients, sendBufs, sim.tiles_[0]);
-        }
+            Room& room = rooms[r];
 
-        // @TODO:
-        // sleep for 4 ms
-        usleep(4000);
+            if(room.active && room.needSetNewGame)
+            {
+                setNewGame(clients, conns, r, room, pool);
+            }
+        }
     }
-    
-    for(Client& client: clients)
-        close(client.sockfd);
 
+    pool.stop();
+    reactor.shutdown();
     close(sockfd);
+    close(udpfd);
     printf("end of the main function\n");
     return 0;
 }